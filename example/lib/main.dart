@@ -21,6 +21,7 @@ class _MaidLlmAppState extends State<MaidLlmApp> {
   final TextEditingController _controller = TextEditingController();
   final List<ChatMessage> _messages = [];
   String? _model;
+  LlamaCPP? _llamaCpp;
 
   void _loadModel() async {
     final result = await FilePicker.platform.pickFiles(
@@ -31,14 +32,26 @@ class _MaidLlmAppState extends State<MaidLlmApp> {
     );
 
     if (result != null && result.files.isNotEmpty) {
+      _llamaCpp?.dispose();
+
       setState(() {
         _model = result.files.single.path!;
+        _llamaCpp = LlamaCPP(
+          _model!,
+          ModelParams(),
+          ContextParams(),
+          SamplingParams(
+            minP: (p: 0.05, minKeep: 1),
+            temperature: (temperature: 0.8, delta: null, exponent: null),
+            seed: Random().nextInt(1000000)
+          )
+        );
       });
     }
   }
 
   void _onSubmitted(String value) async {
-    if (_model == null) {
+    if (_llamaCpp == null) {
       return;
     }
 
@@ -47,16 +60,7 @@ class _MaidLlmAppState extends State<MaidLlmApp> {
       _controller.clear();
     });
 
-    Stream<String> stream = LlamaCPP(
-      _model!,
-      ModelParams(),
-      ContextParams(),
-      SamplingParams(
-        minP: (p: 0.05, minKeep: 1),
-        temperature: (temperature: 0.8, delta: null, exponent: null),
-        seed: Random().nextInt(1000000)
-      )
-    ).prompt(_messages);
+    Stream<String> stream = _llamaCpp!.prompt(_messages);
 
     setState(() {
       _messages.add(ChatMessage(role: 'assistant', content: ""));
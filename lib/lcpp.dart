@@ -1,9 +1,12 @@
 library;
 
 import 'dart:async';
+import 'dart:convert';
 import 'dart:ffi' as ffi;
 import 'dart:io';
 import 'dart:isolate';
+import 'dart:math';
+import 'dart:typed_data';
 
 import 'package:ffi/ffi.dart';
 
@@ -12,5 +15,11 @@ import 'bindings.dart';
 part 'src/llama_cpp.dart';
 part 'src/model_params.dart';
 part 'src/chat_message.dart';
+part 'src/chat_cache.dart';
 part 'src/context_params.dart';
-part 'src/sampling_params.dart';
\ No newline at end of file
+part 'src/draft_params.dart';
+part 'src/generation_params.dart';
+part 'src/memory_planner.dart';
+part 'src/sampling_params.dart';
+part 'src/scratch_pool.dart';
+part 'src/threadpool_params.dart';
\ No newline at end of file
@@ -14065,6 +14065,743 @@ class lcpp {
           'ggml_backend_cpu_reg');
   late final _ggml_backend_cpu_reg =
       _ggml_backend_cpu_regPtr.asFunction<ggml_backend_reg_t Function()>();
+
+  lcpp_generate_params lcpp_generate_default_params() {
+    return _lcpp_generate_default_params();
+  }
+
+  late final _lcpp_generate_default_paramsPtr =
+      _lookup<ffi.NativeFunction<lcpp_generate_params Function()>>(
+          'lcpp_generate_default_params');
+  late final _lcpp_generate_default_params = _lcpp_generate_default_paramsPtr
+      .asFunction<lcpp_generate_params Function()>();
+
+  ffi.Pointer<llama_model> lcpp_model_acquire(
+    ffi.Pointer<ffi.Char> path_model,
+    llama_model_params params,
+  ) {
+    return _lcpp_model_acquire(
+      path_model,
+      params,
+    );
+  }
+
+  late final _lcpp_model_acquirePtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Pointer<llama_model> Function(ffi.Pointer<ffi.Char>,
+              llama_model_params)>>('lcpp_model_acquire');
+  late final _lcpp_model_acquire = _lcpp_model_acquirePtr.asFunction<
+      ffi.Pointer<llama_model> Function(
+          ffi.Pointer<ffi.Char>, llama_model_params)>();
+
+  void lcpp_model_release(
+    ffi.Pointer<llama_model> model,
+  ) {
+    return _lcpp_model_release(
+      model,
+    );
+  }
+
+  late final _lcpp_model_releasePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Pointer<llama_model>)>>(
+          'lcpp_model_release');
+  late final _lcpp_model_release = _lcpp_model_releasePtr
+      .asFunction<void Function(ffi.Pointer<llama_model>)>();
+
+  lcpp_model_registry_stats lcpp_model_registry_get_stats() {
+    return _lcpp_model_registry_get_stats();
+  }
+
+  late final _lcpp_model_registry_get_statsPtr =
+      _lookup<ffi.NativeFunction<lcpp_model_registry_stats Function()>>(
+          'lcpp_model_registry_get_stats');
+  late final _lcpp_model_registry_get_stats = _lcpp_model_registry_get_statsPtr
+      .asFunction<lcpp_model_registry_stats Function()>();
+
+  bool lcpp_model_is_loaded(
+    ffi.Pointer<ffi.Char> path_model,
+    llama_model_params params,
+  ) {
+    return _lcpp_model_is_loaded(
+      path_model,
+      params,
+    );
+  }
+
+  late final _lcpp_model_is_loadedPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Bool Function(ffi.Pointer<ffi.Char>,
+              llama_model_params)>>('lcpp_model_is_loaded');
+  late final _lcpp_model_is_loaded = _lcpp_model_is_loadedPtr
+      .asFunction<bool Function(ffi.Pointer<ffi.Char>, llama_model_params)>();
+
+  ffi.Pointer<llama_adapter_lora> lcpp_adapter_acquire(
+    ffi.Pointer<llama_model> model,
+    ffi.Pointer<ffi.Char> path_lora,
+  ) {
+    return _lcpp_adapter_acquire(
+      model,
+      path_lora,
+    );
+  }
+
+  late final _lcpp_adapter_acquirePtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Pointer<llama_adapter_lora> Function(ffi.Pointer<llama_model>,
+              ffi.Pointer<ffi.Char>)>>('lcpp_adapter_acquire');
+  late final _lcpp_adapter_acquire = _lcpp_adapter_acquirePtr.asFunction<
+      ffi.Pointer<llama_adapter_lora> Function(
+          ffi.Pointer<llama_model>, ffi.Pointer<ffi.Char>)>();
+
+  void lcpp_adapter_release(
+    ffi.Pointer<llama_adapter_lora> adapter,
+  ) {
+    return _lcpp_adapter_release(
+      adapter,
+    );
+  }
+
+  late final _lcpp_adapter_releasePtr = _lookup<
+          ffi
+          .NativeFunction<ffi.Void Function(ffi.Pointer<llama_adapter_lora>)>>(
+      'lcpp_adapter_release');
+  late final _lcpp_adapter_release = _lcpp_adapter_releasePtr
+      .asFunction<void Function(ffi.Pointer<llama_adapter_lora>)>();
+
+  int lcpp_backend_info(
+    ffi.Pointer<ffi.Char> buf,
+    int length,
+  ) {
+    return _lcpp_backend_info(
+      buf,
+      length,
+    );
+  }
+
+  late final _lcpp_backend_infoPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Int32 Function(
+              ffi.Pointer<ffi.Char>, ffi.Int32)>>('lcpp_backend_info');
+  late final _lcpp_backend_info = _lcpp_backend_infoPtr
+      .asFunction<int Function(ffi.Pointer<ffi.Char>, int)>();
+
+  int lcpp_model_read_info(
+    ffi.Pointer<ffi.Char> path_model,
+    ffi.Pointer<lcpp_model_info> info,
+  ) {
+    return _lcpp_model_read_info(
+      path_model,
+      info,
+    );
+  }
+
+  late final _lcpp_model_read_infoPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Int32 Function(ffi.Pointer<ffi.Char>,
+              ffi.Pointer<lcpp_model_info>)>>('lcpp_model_read_info');
+  late final _lcpp_model_read_info = _lcpp_model_read_infoPtr.asFunction<
+      int Function(ffi.Pointer<ffi.Char>, ffi.Pointer<lcpp_model_info>)>();
+
+  ffi.Pointer<lcpp_prefetch> lcpp_prefetch_start(
+    ffi.Pointer<ffi.Char> path_model,
+  ) {
+    return _lcpp_prefetch_start(
+      path_model,
+    );
+  }
+
+  late final _lcpp_prefetch_startPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Pointer<lcpp_prefetch> Function(
+              ffi.Pointer<ffi.Char>)>>('lcpp_prefetch_start');
+  late final _lcpp_prefetch_start = _lcpp_prefetch_startPtr
+      .asFunction<ffi.Pointer<lcpp_prefetch> Function(ffi.Pointer<ffi.Char>)>();
+
+  double lcpp_prefetch_progress(
+    ffi.Pointer<lcpp_prefetch> prefetch,
+  ) {
+    return _lcpp_prefetch_progress(
+      prefetch,
+    );
+  }
+
+  late final _lcpp_prefetch_progressPtr = _lookup<
+          ffi.NativeFunction<ffi.Float Function(ffi.Pointer<lcpp_prefetch>)>>(
+      'lcpp_prefetch_progress');
+  late final _lcpp_prefetch_progress = _lcpp_prefetch_progressPtr
+      .asFunction<double Function(ffi.Pointer<lcpp_prefetch>)>();
+
+  void lcpp_prefetch_free(
+    ffi.Pointer<lcpp_prefetch> prefetch,
+  ) {
+    return _lcpp_prefetch_free(
+      prefetch,
+    );
+  }
+
+  late final _lcpp_prefetch_freePtr = _lookup<
+          ffi.NativeFunction<ffi.Void Function(ffi.Pointer<lcpp_prefetch>)>>(
+      'lcpp_prefetch_free');
+  late final _lcpp_prefetch_free = _lcpp_prefetch_freePtr
+      .asFunction<void Function(ffi.Pointer<lcpp_prefetch>)>();
+
+  void lcpp_numa_init(
+    int numa,
+  ) {
+    return _lcpp_numa_init(
+      numa,
+    );
+  }
+
+  late final _lcpp_numa_initPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Int32)>>(
+          'lcpp_numa_init');
+  late final _lcpp_numa_init =
+      _lcpp_numa_initPtr.asFunction<void Function(int)>();
+
+  ffi.Pointer<ggml_threadpool> lcpp_threadpool_acquire(
+    ffi.Pointer<ggml_threadpool_params> params,
+  ) {
+    return _lcpp_threadpool_acquire(
+      params,
+    );
+  }
+
+  late final _lcpp_threadpool_acquirePtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Pointer<ggml_threadpool> Function(
+              ffi.Pointer<ggml_threadpool_params>)>>('lcpp_threadpool_acquire');
+  late final _lcpp_threadpool_acquire = _lcpp_threadpool_acquirePtr.asFunction<
+      ffi.Pointer<ggml_threadpool> Function(
+          ffi.Pointer<ggml_threadpool_params>)>();
+
+  void lcpp_threadpool_release(
+    ffi.Pointer<ggml_threadpool> threadpool,
+  ) {
+    return _lcpp_threadpool_release(
+      threadpool,
+    );
+  }
+
+  late final _lcpp_threadpool_releasePtr = _lookup<
+          ffi.NativeFunction<ffi.Void Function(ffi.Pointer<ggml_threadpool>)>>(
+      'lcpp_threadpool_release');
+  late final _lcpp_threadpool_release = _lcpp_threadpool_releasePtr
+      .asFunction<void Function(ffi.Pointer<ggml_threadpool>)>();
+
+  void lcpp_threadpool_attach(
+    ffi.Pointer<llama_context> ctx,
+    ffi.Pointer<ggml_threadpool> threadpool,
+    ffi.Pointer<ggml_threadpool> threadpool_batch,
+  ) {
+    return _lcpp_threadpool_attach(
+      ctx,
+      threadpool,
+      threadpool_batch,
+    );
+  }
+
+  late final _lcpp_threadpool_attachPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Void Function(
+              ffi.Pointer<llama_context>,
+              ffi.Pointer<ggml_threadpool>,
+              ffi.Pointer<ggml_threadpool>)>>('lcpp_threadpool_attach');
+  late final _lcpp_threadpool_attach = _lcpp_threadpool_attachPtr.asFunction<
+      void Function(ffi.Pointer<llama_context>, ffi.Pointer<ggml_threadpool>,
+          ffi.Pointer<ggml_threadpool>)>();
+
+  void lcpp_threadpool_detach(
+    ffi.Pointer<llama_context> ctx,
+  ) {
+    return _lcpp_threadpool_detach(
+      ctx,
+    );
+  }
+
+  late final _lcpp_threadpool_detachPtr = _lookup<
+          ffi.NativeFunction<ffi.Void Function(ffi.Pointer<llama_context>)>>(
+      'lcpp_threadpool_detach');
+  late final _lcpp_threadpool_detach = _lcpp_threadpool_detachPtr
+      .asFunction<void Function(ffi.Pointer<llama_context>)>();
+
+  ffi.Pointer<llama_sampler> lcpp_grammar_init(
+    ffi.Pointer<llama_vocab> vocab,
+    ffi.Pointer<ffi.Char> grammar,
+    ffi.Pointer<ffi.Char> root,
+    bool json_schema,
+    ffi.Pointer<ffi.Char> error,
+    int n_error,
+  ) {
+    return _lcpp_grammar_init(
+      vocab,
+      grammar,
+      root,
+      json_schema,
+      error,
+      n_error,
+    );
+  }
+
+  late final _lcpp_grammar_initPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Pointer<llama_sampler> Function(
+              ffi.Pointer<llama_vocab>,
+              ffi.Pointer<ffi.Char>,
+              ffi.Pointer<ffi.Char>,
+              ffi.Bool,
+              ffi.Pointer<ffi.Char>,
+              ffi.Int32)>>('lcpp_grammar_init');
+  late final _lcpp_grammar_init = _lcpp_grammar_initPtr.asFunction<
+      ffi.Pointer<llama_sampler> Function(ffi.Pointer<llama_vocab>,
+          ffi.Pointer<ffi.Char>, ffi.Pointer<ffi.Char>, bool, ffi.Pointer<ffi.Char>, int)>();
+
+  int lcpp_generate(
+    ffi.Pointer<llama_context> ctx,
+    ffi.Pointer<llama_sampler> sampler,
+    ffi.Pointer<llama_token> tokens,
+    int n_tokens,
+    lcpp_generate_params params,
+  ) {
+    return _lcpp_generate(
+      ctx,
+      sampler,
+      tokens,
+      n_tokens,
+      params,
+    );
+  }
+
+  late final _lcpp_generatePtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Int32 Function(
+              ffi.Pointer<llama_context>,
+              ffi.Pointer<llama_sampler>,
+              ffi.Pointer<llama_token>,
+              ffi.Int32,
+              lcpp_generate_params)>>('lcpp_generate');
+  late final _lcpp_generate = _lcpp_generatePtr.asFunction<
+      int Function(ffi.Pointer<llama_context>, ffi.Pointer<llama_sampler>,
+          ffi.Pointer<llama_token>, int, lcpp_generate_params)>();
+
+  int lcpp_embed(
+    ffi.Pointer<llama_context> ctx,
+    ffi.Pointer<llama_token> tokens,
+    ffi.Pointer<ffi.Int32> n_tokens,
+    int n_inputs,
+    bool normalize,
+    ffi.Pointer<ffi.Float> out,
+  ) {
+    return _lcpp_embed(
+      ctx,
+      tokens,
+      n_tokens,
+      n_inputs,
+      normalize,
+      out,
+    );
+  }
+
+  late final _lcpp_embedPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Int32 Function(
+              ffi.Pointer<llama_context>,
+              ffi.Pointer<llama_token>,
+              ffi.Pointer<ffi.Int32>,
+              ffi.Int32,
+              ffi.Bool,
+              ffi.Pointer<ffi.Float>)>>('lcpp_embed');
+  late final _lcpp_embed = _lcpp_embedPtr.asFunction<
+      int Function(ffi.Pointer<llama_context>, ffi.Pointer<llama_token>,
+          ffi.Pointer<ffi.Int32>, int, bool, ffi.Pointer<ffi.Float>)>();
+
+  int lcpp_score(
+    ffi.Pointer<llama_context> ctx,
+    ffi.Pointer<llama_token> tokens,
+    int n_tokens,
+    ffi.Pointer<llama_token> candidates,
+    ffi.Pointer<ffi.Int32> n_candidate_tokens,
+    int n_candidates,
+    ffi.Pointer<ffi.Float> logprobs,
+    lcpp_generate_params params,
+  ) {
+    return _lcpp_score(
+      ctx,
+      tokens,
+      n_tokens,
+      candidates,
+      n_candidate_tokens,
+      n_candidates,
+      logprobs,
+      params,
+    );
+  }
+
+  late final _lcpp_scorePtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Int32 Function(
+              ffi.Pointer<llama_context>,
+              ffi.Pointer<llama_token>,
+              ffi.Int32,
+              ffi.Pointer<llama_token>,
+              ffi.Pointer<ffi.Int32>,
+              ffi.Int32,
+              ffi.Pointer<ffi.Float>,
+              lcpp_generate_params)>>('lcpp_score');
+  late final _lcpp_score = _lcpp_scorePtr.asFunction<
+      int Function(
+          ffi.Pointer<llama_context>,
+          ffi.Pointer<llama_token>,
+          int,
+          ffi.Pointer<llama_token>,
+          ffi.Pointer<ffi.Int32>,
+          int,
+          ffi.Pointer<ffi.Float>,
+          lcpp_generate_params)>();
+
+  bool lcpp_vocab_compatible(
+    ffi.Pointer<llama_model> model_tgt,
+    ffi.Pointer<llama_model> model_dft,
+  ) {
+    return _lcpp_vocab_compatible(
+      model_tgt,
+      model_dft,
+    );
+  }
+
+  late final _lcpp_vocab_compatiblePtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Bool Function(ffi.Pointer<llama_model>,
+              ffi.Pointer<llama_model>)>>('lcpp_vocab_compatible');
+  late final _lcpp_vocab_compatible = _lcpp_vocab_compatiblePtr.asFunction<
+      bool Function(ffi.Pointer<llama_model>, ffi.Pointer<llama_model>)>();
+
+  ffi.Pointer<lcpp_draft> lcpp_draft_init(
+    ffi.Pointer<llama_context> ctx,
+    int n_draft,
+    double p_min,
+  ) {
+    return _lcpp_draft_init(
+      ctx,
+      n_draft,
+      p_min,
+    );
+  }
+
+  late final _lcpp_draft_initPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Pointer<lcpp_draft> Function(ffi.Pointer<llama_context>,
+              ffi.Int32, ffi.Float)>>('lcpp_draft_init');
+  late final _lcpp_draft_init = _lcpp_draft_initPtr.asFunction<
+      ffi.Pointer<lcpp_draft> Function(
+          ffi.Pointer<llama_context>, int, double)>();
+
+  ffi.Pointer<lcpp_draft> lcpp_draft_init_ngram(
+    int n_draft,
+    int n_min,
+    int n_max,
+  ) {
+    return _lcpp_draft_init_ngram(
+      n_draft,
+      n_min,
+      n_max,
+    );
+  }
+
+  late final _lcpp_draft_init_ngramPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Pointer<lcpp_draft> Function(
+              ffi.Int32, ffi.Int32, ffi.Int32)>>('lcpp_draft_init_ngram');
+  late final _lcpp_draft_init_ngram = _lcpp_draft_init_ngramPtr
+      .asFunction<ffi.Pointer<lcpp_draft> Function(int, int, int)>();
+
+  void lcpp_draft_free(
+    ffi.Pointer<lcpp_draft> draft,
+  ) {
+    return _lcpp_draft_free(
+      draft,
+    );
+  }
+
+  late final _lcpp_draft_freePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Pointer<lcpp_draft>)>>(
+          'lcpp_draft_free');
+  late final _lcpp_draft_free =
+      _lcpp_draft_freePtr.asFunction<void Function(ffi.Pointer<lcpp_draft>)>();
+
+  lcpp_draft_stats lcpp_draft_get_stats(
+    ffi.Pointer<lcpp_draft> draft,
+  ) {
+    return _lcpp_draft_get_stats(
+      draft,
+    );
+  }
+
+  late final _lcpp_draft_get_statsPtr = _lookup<
+          ffi
+          .NativeFunction<lcpp_draft_stats Function(ffi.Pointer<lcpp_draft>)>>(
+      'lcpp_draft_get_stats');
+  late final _lcpp_draft_get_stats = _lcpp_draft_get_statsPtr
+      .asFunction<lcpp_draft_stats Function(ffi.Pointer<lcpp_draft>)>();
+
+  int lcpp_session_save(
+    ffi.Pointer<llama_context> ctx,
+    ffi.Pointer<ffi.Char> path,
+    ffi.Pointer<llama_token> tokens,
+    int n_tokens,
+  ) {
+    return _lcpp_session_save(
+      ctx,
+      path,
+      tokens,
+      n_tokens,
+    );
+  }
+
+  late final _lcpp_session_savePtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Int32 Function(ffi.Pointer<llama_context>, ffi.Pointer<ffi.Char>,
+              ffi.Pointer<llama_token>, ffi.Int32)>>('lcpp_session_save');
+  late final _lcpp_session_save = _lcpp_session_savePtr.asFunction<
+      int Function(ffi.Pointer<llama_context>, ffi.Pointer<ffi.Char>,
+          ffi.Pointer<llama_token>, int)>();
+
+  int lcpp_session_load(
+    ffi.Pointer<llama_context> ctx,
+    ffi.Pointer<ffi.Char> path,
+    ffi.Pointer<llama_token> tokens,
+    int n_capacity,
+    ffi.Pointer<ffi.Int32> n_tokens,
+  ) {
+    return _lcpp_session_load(
+      ctx,
+      path,
+      tokens,
+      n_capacity,
+      n_tokens,
+    );
+  }
+
+  late final _lcpp_session_loadPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Int32 Function(
+              ffi.Pointer<llama_context>,
+              ffi.Pointer<ffi.Char>,
+              ffi.Pointer<llama_token>,
+              ffi.Int32,
+              ffi.Pointer<ffi.Int32>)>>('lcpp_session_load');
+  late final _lcpp_session_load = _lcpp_session_loadPtr.asFunction<
+      int Function(ffi.Pointer<llama_context>, ffi.Pointer<ffi.Char>,
+          ffi.Pointer<llama_token>, int, ffi.Pointer<ffi.Int32>)>();
+
+  ffi.Pointer<lcpp_stream> lcpp_stream_init(
+    int n_text,
+    int n_tokens,
+    lcpp_stream_callback callback,
+    ffi.Pointer<ffi.Void> user_data,
+  ) {
+    return _lcpp_stream_init(
+      n_text,
+      n_tokens,
+      callback,
+      user_data,
+    );
+  }
+
+  late final _lcpp_stream_initPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Pointer<lcpp_stream> Function(ffi.Int32, ffi.Int32,
+              lcpp_stream_callback, ffi.Pointer<ffi.Void>)>>('lcpp_stream_init');
+  late final _lcpp_stream_init = _lcpp_stream_initPtr.asFunction<
+      ffi.Pointer<lcpp_stream> Function(
+          int, int, lcpp_stream_callback, ffi.Pointer<ffi.Void>)>();
+
+  void lcpp_stream_free(
+    ffi.Pointer<lcpp_stream> stream,
+  ) {
+    return _lcpp_stream_free(
+      stream,
+    );
+  }
+
+  late final _lcpp_stream_freePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Pointer<lcpp_stream>)>>(
+          'lcpp_stream_free');
+  late final _lcpp_stream_free = _lcpp_stream_freePtr
+      .asFunction<void Function(ffi.Pointer<lcpp_stream>)>();
+
+  int lcpp_stream_peek_text(
+    ffi.Pointer<lcpp_stream> stream,
+    ffi.Pointer<ffi.Pointer<ffi.Char>> text,
+  ) {
+    return _lcpp_stream_peek_text(
+      stream,
+      text,
+    );
+  }
+
+  late final _lcpp_stream_peek_textPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Int32 Function(ffi.Pointer<lcpp_stream>,
+              ffi.Pointer<ffi.Pointer<ffi.Char>>)>>('lcpp_stream_peek_text');
+  late final _lcpp_stream_peek_text = _lcpp_stream_peek_textPtr.asFunction<
+      int Function(
+          ffi.Pointer<lcpp_stream>, ffi.Pointer<ffi.Pointer<ffi.Char>>)>();
+
+  void lcpp_stream_consume_text(
+    ffi.Pointer<lcpp_stream> stream,
+    int n,
+  ) {
+    return _lcpp_stream_consume_text(
+      stream,
+      n,
+    );
+  }
+
+  late final _lcpp_stream_consume_textPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Void Function(
+              ffi.Pointer<lcpp_stream>, ffi.Int32)>>('lcpp_stream_consume_text');
+  late final _lcpp_stream_consume_text = _lcpp_stream_consume_textPtr
+      .asFunction<void Function(ffi.Pointer<lcpp_stream>, int)>();
+
+  int lcpp_stream_peek_tokens(
+    ffi.Pointer<lcpp_stream> stream,
+    ffi.Pointer<ffi.Pointer<llama_token>> tokens,
+  ) {
+    return _lcpp_stream_peek_tokens(
+      stream,
+      tokens,
+    );
+  }
+
+  late final _lcpp_stream_peek_tokensPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Int32 Function(ffi.Pointer<lcpp_stream>,
+              ffi.Pointer<ffi.Pointer<llama_token>>)>>('lcpp_stream_peek_tokens');
+  late final _lcpp_stream_peek_tokens = _lcpp_stream_peek_tokensPtr.asFunction<
+      int Function(
+          ffi.Pointer<lcpp_stream>, ffi.Pointer<ffi.Pointer<llama_token>>)>();
+
+  void lcpp_stream_consume_tokens(
+    ffi.Pointer<lcpp_stream> stream,
+    int n,
+  ) {
+    return _lcpp_stream_consume_tokens(
+      stream,
+      n,
+    );
+  }
+
+  late final _lcpp_stream_consume_tokensPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Void Function(
+              ffi.Pointer<lcpp_stream>, ffi.Int32)>>('lcpp_stream_consume_tokens');
+  late final _lcpp_stream_consume_tokens = _lcpp_stream_consume_tokensPtr
+      .asFunction<void Function(ffi.Pointer<lcpp_stream>, int)>();
+
+  ffi.Pointer<lcpp_server> lcpp_server_init(
+    ffi.Pointer<llama_context> ctx,
+    lcpp_server_callback callback,
+    ffi.Pointer<ffi.Void> user_data,
+  ) {
+    return _lcpp_server_init(
+      ctx,
+      callback,
+      user_data,
+    );
+  }
+
+  late final _lcpp_server_initPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Pointer<lcpp_server> Function(ffi.Pointer<llama_context>,
+              lcpp_server_callback, ffi.Pointer<ffi.Void>)>>('lcpp_server_init');
+  late final _lcpp_server_init = _lcpp_server_initPtr.asFunction<
+      ffi.Pointer<lcpp_server> Function(ffi.Pointer<llama_context>,
+          lcpp_server_callback, ffi.Pointer<ffi.Void>)>();
+
+  void lcpp_server_free(
+    ffi.Pointer<lcpp_server> server,
+  ) {
+    return _lcpp_server_free(
+      server,
+    );
+  }
+
+  late final _lcpp_server_freePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Pointer<lcpp_server>)>>(
+          'lcpp_server_free');
+  late final _lcpp_server_free = _lcpp_server_freePtr
+      .asFunction<void Function(ffi.Pointer<lcpp_server>)>();
+
+  int lcpp_server_submit(
+    ffi.Pointer<lcpp_server> server,
+    ffi.Pointer<llama_sampler> sampler,
+    ffi.Pointer<llama_token> tokens,
+    int n_tokens,
+  ) {
+    return _lcpp_server_submit(
+      server,
+      sampler,
+      tokens,
+      n_tokens,
+    );
+  }
+
+  late final _lcpp_server_submitPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Int32 Function(ffi.Pointer<lcpp_server>, ffi.Pointer<llama_sampler>,
+              ffi.Pointer<llama_token>, ffi.Int32)>>('lcpp_server_submit');
+  late final _lcpp_server_submit = _lcpp_server_submitPtr.asFunction<
+      int Function(ffi.Pointer<lcpp_server>, ffi.Pointer<llama_sampler>,
+          ffi.Pointer<llama_token>, int)>();
+
+  void lcpp_server_cancel(
+    ffi.Pointer<lcpp_server> server,
+    int request_id,
+  ) {
+    return _lcpp_server_cancel(
+      server,
+      request_id,
+    );
+  }
+
+  late final _lcpp_server_cancelPtr = _lookup<
+          ffi.NativeFunction<ffi.Void Function(ffi.Pointer<lcpp_server>, ffi.Int32)>>(
+      'lcpp_server_cancel');
+  late final _lcpp_server_cancel = _lcpp_server_cancelPtr
+      .asFunction<void Function(ffi.Pointer<lcpp_server>, int)>();
+
+  int lcpp_server_read(
+    ffi.Pointer<lcpp_server> server,
+    int request_id,
+    ffi.Pointer<ffi.Char> buf,
+    int length,
+    ffi.Pointer<ffi.Bool> done,
+    ffi.Pointer<ffi.Int32> status,
+  ) {
+    return _lcpp_server_read(
+      server,
+      request_id,
+      buf,
+      length,
+      done,
+      status,
+    );
+  }
+
+  late final _lcpp_server_readPtr = _lookup<
+      ffi.NativeFunction<
+          ffi.Int32 Function(
+              ffi.Pointer<lcpp_server>,
+              ffi.Int32,
+              ffi.Pointer<ffi.Char>,
+              ffi.Int32,
+              ffi.Pointer<ffi.Bool>,
+              ffi.Pointer<ffi.Int32>)>>('lcpp_server_read');
+  late final _lcpp_server_read = _lcpp_server_readPtr.asFunction<
+      int Function(ffi.Pointer<lcpp_server>, int, ffi.Pointer<ffi.Char>, int,
+          ffi.Pointer<ffi.Bool>, ffi.Pointer<ffi.Int32>)>();
 }
 
 final class __mbstate_t extends ffi.Union {
@@ -15366,6 +16103,190 @@ typedef Dartggml_vec_dot_tFunction = void Function(
     int nrc);
 typedef ggml_threadpool_t = ffi.Pointer<ggml_threadpool>;
 
+abstract class lcpp_status {
+  static const int LCPP_STATUS_OK = 0;
+  static const int LCPP_STATUS_CONTEXT_FULL = 1;
+  static const int LCPP_STATUS_DECODE_FAILED = -1;
+  static const int LCPP_STATUS_DETOKENIZE_FAILED = -2;
+  static const int LCPP_STATUS_FILE_FAILED = -3;
+  static const int LCPP_STATUS_SESSION_MISMATCH = -4;
+  static const int LCPP_STATUS_NO_EMBEDDINGS = -5;
+}
+
+final class lcpp_generate_timings extends ffi.Struct {
+  @ffi.Int32()
+  external int n_tokens;
+
+  @ffi.Int32()
+  external int n_emits;
+
+  @ffi.Double()
+  external double t_detokenize_ms;
+
+  @ffi.Double()
+  external double t_emit_ms;
+
+  @ffi.Double()
+  external double t_prefill_ms;
+
+  @ffi.Double()
+  external double t_decode_ms;
+}
+
+final class lcpp_generate_params extends ffi.Struct {
+  external lcpp_text_callback text_callback;
+
+  external ffi.Pointer<ffi.Void> text_callback_user_data;
+
+  external lcpp_prefill_callback prefill_callback;
+
+  external ffi.Pointer<ffi.Void> prefill_callback_user_data;
+
+  external lcpp_probs_callback probs_callback;
+
+  external ffi.Pointer<ffi.Void> probs_callback_user_data;
+
+  @ffi.Int32()
+  external int n_probs;
+
+  external ffi.Pointer<llama_token> history;
+
+  external ffi.Pointer<ffi.Int32> n_history;
+
+  @ffi.Int32()
+  external int n_keep;
+
+  @ffi.Int32()
+  external int n_flush_tokens;
+
+  @ffi.Double()
+  external double t_flush_ms;
+
+  external ffi.Pointer<ffi.Bool> abort;
+
+  external ffi.Pointer<lcpp_stream> stream;
+
+  external ffi.Pointer<lcpp_draft> draft;
+
+  external ffi.Pointer<lcpp_generate_timings> timings;
+}
+
+typedef lcpp_text_callback
+    = ffi.Pointer<ffi.NativeFunction<lcpp_text_callbackFunction>>;
+typedef lcpp_text_callbackFunction = ffi.Bool Function(
+    ffi.Pointer<ffi.Char> text,
+    ffi.Int32 length,
+    ffi.Pointer<ffi.Void> user_data);
+typedef Dartlcpp_text_callbackFunction = bool Function(
+    ffi.Pointer<ffi.Char> text, int length, ffi.Pointer<ffi.Void> user_data);
+typedef lcpp_prefill_callback
+    = ffi.Pointer<ffi.NativeFunction<lcpp_prefill_callbackFunction>>;
+typedef lcpp_prefill_callbackFunction = ffi.Bool Function(ffi.Int32 n_decoded,
+    ffi.Int32 n_total, ffi.Double t_ms, ffi.Pointer<ffi.Void> user_data);
+typedef Dartlcpp_prefill_callbackFunction = bool Function(
+    int n_decoded, int n_total, double t_ms, ffi.Pointer<ffi.Void> user_data);
+typedef lcpp_probs_callback
+    = ffi.Pointer<ffi.NativeFunction<lcpp_probs_callbackFunction>>;
+typedef lcpp_probs_callbackFunction = ffi.Void Function(
+    llama_token token,
+    ffi.Float logprob,
+    ffi.Pointer<llama_token> top_tokens,
+    ffi.Pointer<ffi.Float> top_logprobs,
+    ffi.Int32 n_top,
+    ffi.Pointer<ffi.Void> user_data);
+typedef Dartlcpp_probs_callbackFunction = void Function(
+    Dartllama_token token,
+    double logprob,
+    ffi.Pointer<llama_token> top_tokens,
+    ffi.Pointer<ffi.Float> top_logprobs,
+    int n_top,
+    ffi.Pointer<ffi.Void> user_data);
+
+final class lcpp_stream extends ffi.Opaque {}
+
+typedef lcpp_stream_callback
+    = ffi.Pointer<ffi.NativeFunction<lcpp_stream_callbackFunction>>;
+typedef lcpp_stream_callbackFunction = ffi.Void Function(
+    ffi.Pointer<ffi.Void> user_data);
+typedef Dartlcpp_stream_callbackFunction = void Function(
+    ffi.Pointer<ffi.Void> user_data);
+
+final class lcpp_draft extends ffi.Opaque {}
+
+final class lcpp_prefetch extends ffi.Opaque {}
+
+final class lcpp_draft_stats extends ffi.Struct {
+  @ffi.Int32()
+  external int n_steps;
+
+  @ffi.Int32()
+  external int n_drafted;
+
+  @ffi.Int32()
+  external int n_accepted;
+}
+
+final class lcpp_model_registry_stats extends ffi.Struct {
+  @ffi.Int32()
+  external int n_models;
+
+  @ffi.Int32()
+  external int n_refs;
+
+  @ffi.Int32()
+  external int n_loads;
+
+  @ffi.Int32()
+  external int n_hits;
+
+  @ffi.Uint64()
+  external int n_bytes;
+
+  @ffi.Double()
+  external double t_load_ms;
+}
+
+final class lcpp_model_info extends ffi.Struct {
+  @ffi.Int32()
+  external int n_layer;
+
+  @ffi.Int32()
+  external int n_embd;
+
+  @ffi.Int32()
+  external int n_ff;
+
+  @ffi.Int32()
+  external int n_head;
+
+  @ffi.Int32()
+  external int n_head_kv;
+
+  @ffi.Int32()
+  external int n_embd_head_k;
+
+  @ffi.Int32()
+  external int n_embd_head_v;
+
+  @ffi.Int32()
+  external int n_ctx_train;
+
+  @ffi.Int32()
+  external int n_vocab;
+
+  @ffi.Uint64()
+  external int n_bytes;
+}
+
+typedef lcpp_server_callback
+    = ffi.Pointer<ffi.NativeFunction<lcpp_server_callbackFunction>>;
+typedef lcpp_server_callbackFunction = ffi.Void Function(
+    ffi.Int32 request_id, ffi.Pointer<ffi.Void> user_data);
+typedef Dartlcpp_server_callbackFunction = void Function(
+    int request_id, ffi.Pointer<ffi.Void> user_data);
+
+final class lcpp_server extends ffi.Opaque {}
+
 const int __has_safe_buffers = 1;
 
 const int __DARWIN_ONLY_64_BIT_INO_T = 1;
@@ -0,0 +1,298 @@
+part of '../lcpp.dart';
+
+/// Rendered template text and token ids of the conversation an inference
+/// isolate was last prompted with.
+///
+/// Chats grow by appending messages, so when a prompt's history starts with
+/// the cached messages only the new messages are copied into native memory
+/// and only the text the template rendered after the last control token of
+/// the cached text is tokenized. Text after a control token tokenizes the same
+/// on its own with byte pair encoding vocabs, other vocabs add a space prefix
+/// to it and are always tokenized in full. An edited message, or a template
+/// that renders earlier turns differently once more follow, also falls back
+/// to tokenizing everything. The template itself can only render whole
+/// conversations, so that and the prefix comparison stay proportional to the
+/// conversation, but both are plain byte copies and comparisons.
+///
+/// Its native memory comes from [ScratchPool], so it is counted with the
+/// buffers prompts go through.
+class ChatCache {
+  final ScratchPool _pool;
+
+  final List<ChatMessage> _messages = [];
+  ffi.Pointer<llama_chat_message> _native = ffi.nullptr;
+  int _nativeCapacity = 0;
+
+  // Rendered text of the cached messages and the buffer the next render goes to
+  _ScratchBuffer _text = _ScratchBuffer();
+  _ScratchBuffer _next = _ScratchBuffer();
+  int _length = 0;
+
+  ffi.Pointer<llama_token> _tokens = ffi.nullptr;
+  int _tokensCapacity = 0;
+  int _count = 0;
+
+  // Piece of a single token, used to find how much text the tokens after a split cover
+  static const _pieceSize = 256;
+  ffi.Pointer<ffi.Char> _piece = ffi.nullptr;
+
+  /// Number of tokens the last call took from the cache instead of tokenizing.
+  int reusedTokens = 0;
+
+  ChatCache(this._pool);
+
+  /// Renders [messages] with the chat template of [model] and tokenizes them,
+  /// the tokens stay valid until the next call.
+  ({ffi.Pointer<llama_token> tokens, int count}) tokenize(ffi.Pointer<llama_model> model, List<ChatMessage> messages) {
+    int kept = 0;
+    while (
+      kept < _messages.length &&
+      kept < messages.length &&
+      _messages[kept].role == messages[kept].role &&
+      _messages[kept].content == messages[kept].content
+    ) {
+      kept++;
+    }
+
+    final appended = kept == _messages.length;
+
+    _truncate(kept);
+    for (var i = kept; i < messages.length; i++) {
+      _append(messages[i]);
+    }
+
+    final length = _render(model);
+    final vocab = LlamaCPP.lib.llama_model_get_vocab(model);
+
+    // The previous render is reused when the new one extends it, its tokens up to the last
+    // control token are kept and only the text after it is tokenized
+    final split = appended &&
+      _count > 0 &&
+      length >= _length &&
+      LlamaCPP.lib.llama_vocab_type1(vocab) == llama_vocab_type.LLAMA_VOCAB_TYPE_BPE &&
+      _startsWith(_next.pointer, _text.pointer, _length)
+        ? _split(vocab)
+        : null;
+
+    final reused = split?.tokens ?? 0;
+    final offset = split?.length ?? 0;
+
+    int tokenized = LlamaCPP.lib.llama_tokenize(
+      vocab,
+      _next.pointer.cast<ffi.Char>() + offset,
+      length - offset,
+      _tokens + reused,
+      _tokensCapacity - reused,
+      reused == 0,
+      true
+    );
+
+    if (tokenized < 0) {
+      _reserveTokens(reused - tokenized);
+
+      tokenized = LlamaCPP.lib.llama_tokenize(
+        vocab,
+        _next.pointer.cast<ffi.Char>() + offset,
+        length - offset,
+        _tokens + reused,
+        _tokensCapacity - reused,
+        reused == 0,
+        true
+      );
+    }
+
+    if (tokenized < 0) {
+      _clear();
+      throw Exception('Failed to tokenize prompt');
+    }
+
+    final text = _text;
+    _text = _next;
+    _next = text;
+
+    _length = length;
+    _count = reused + tokenized;
+    reusedTokens = reused;
+
+    return (tokens: _tokens, count: _count);
+  }
+
+  void dispose() {
+    _truncate(0);
+
+    if (_piece != ffi.nullptr) {
+      _pool.free(_piece);
+      _piece = ffi.nullptr;
+    }
+
+    if (_native != ffi.nullptr) {
+      _pool.free(_native);
+    }
+
+    if (_tokens != ffi.nullptr) {
+      _pool.free(_tokens);
+    }
+
+    for (final buffer in [_text, _next]) {
+      if (buffer.pointer != ffi.nullptr) {
+        _pool.free(buffer.pointer);
+      }
+
+      buffer.pointer = ffi.nullptr;
+      buffer.capacity = 0;
+    }
+
+    _native = ffi.nullptr;
+    _nativeCapacity = 0;
+    _tokens = ffi.nullptr;
+    _tokensCapacity = 0;
+    _clear();
+  }
+
+  // The number of cached tokens up to and including the last control token, and the length of the
+  // text they cover. Null when there is no control token after the first token to split at
+  ({int tokens, int length})? _split(ffi.Pointer<llama_vocab> vocab) {
+    if (_piece == ffi.nullptr) {
+      _piece = _pool<ffi.Char>(_pieceSize);
+    }
+
+    int length = _length;
+
+    for (var i = _count - 1; i > 0; i--) {
+      if (LlamaCPP.lib.llama_vocab_is_control(vocab, _tokens[i])) {
+        return (tokens: i + 1, length: length);
+      }
+
+      final n = LlamaCPP.lib.llama_token_to_piece(vocab, _tokens[i], _piece, _pieceSize, 0, true);
+      if (n < 0) {
+        return null;
+      }
+
+      length -= n;
+    }
+
+    return null;
+  }
+
+  int _render(ffi.Pointer<llama_model> model) {
+    final template = LlamaCPP.lib.llama_model_chat_template(model, ffi.nullptr);
+
+    int length = LlamaCPP.lib.llama_chat_apply_template(
+      template,
+      _native,
+      _messages.length,
+      true,
+      _next.pointer.cast<ffi.Char>(),
+      _next.capacity
+    );
+
+    if (length > _next.capacity) {
+      _reserveText(_next, length);
+
+      length = LlamaCPP.lib.llama_chat_apply_template(
+        template,
+        _native,
+        _messages.length,
+        true,
+        _next.pointer.cast<ffi.Char>(),
+        _next.capacity
+      );
+    }
+
+    if (length < 0) {
+      _clear();
+      throw Exception('Failed to apply template');
+    }
+
+    return length;
+  }
+
+  void _append(ChatMessage message) {
+    if (_messages.length == _nativeCapacity) {
+      final capacity = max(16, _nativeCapacity * 2);
+      final native = _pool<llama_chat_message>(capacity);
+
+      for (var i = 0; i < _messages.length; i++) {
+        native[i]
+          ..role = _native[i].role
+          ..content = _native[i].content;
+      }
+
+      if (_native != ffi.nullptr) {
+        _pool.free(_native);
+      }
+
+      _native = native;
+      _nativeCapacity = capacity;
+    }
+
+    _native[_messages.length]
+      ..role = message.role.toNativeUtf8(allocator: _pool).cast<ffi.Char>()
+      ..content = message.content.toNativeUtf8(allocator: _pool).cast<ffi.Char>();
+
+    _messages.add(message);
+  }
+
+  void _truncate(int length) {
+    for (var i = length; i < _messages.length; i++) {
+      _pool.free(_native[i].role);
+      _pool.free(_native[i].content);
+    }
+
+    _messages.length = length;
+  }
+
+  void _clear() {
+    _length = 0;
+    _count = 0;
+    reusedTokens = 0;
+  }
+
+  void _reserveText(_ScratchBuffer buffer, int size) {
+    if (buffer.pointer != ffi.nullptr) {
+      _pool.free(buffer.pointer);
+    }
+
+    buffer.capacity = max(size, buffer.capacity * 2);
+    buffer.pointer = _pool<ffi.Uint8>(buffer.capacity);
+  }
+
+  void _reserveTokens(int count) {
+    final capacity = max(count, _tokensCapacity * 2);
+    final tokens = _pool<llama_token>(capacity);
+
+    // The cached prefix is kept, tokens of the appended text go after it
+    if (_count > 0) {
+      tokens.asTypedList(_count).setAll(0, _tokens.asTypedList(_count));
+    }
+
+    if (_tokens != ffi.nullptr) {
+      _pool.free(_tokens);
+    }
+
+    _tokens = tokens;
+    _tokensCapacity = capacity;
+  }
+
+  static bool _startsWith(ffi.Pointer<ffi.Uint8> text, ffi.Pointer<ffi.Uint8> prefix, int length) {
+    final words = length ~/ 8;
+
+    // Both buffers come from calloc, so they are aligned for 64 bit reads
+    final textWords = text.cast<ffi.Uint64>().asTypedList(words);
+    final prefixWords = prefix.cast<ffi.Uint64>().asTypedList(words);
+
+    for (var i = 0; i < words; i++) {
+      if (textWords[i] != prefixWords[i]) {
+        return false;
+      }
+    }
+
+    for (var i = words * 8; i < length; i++) {
+      if (text[i] != prefix[i]) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+}
@@ -13,21 +13,24 @@ class ChatMessage {
       : role = message.role.cast<Utf8>().toDartString(),
         content = message.content.cast<Utf8>().toDartString();
 
-  llama_chat_message toNative() {
-    final message = calloc<llama_chat_message>();
-    message.ref.role = role.toNativeUtf8().cast<ffi.Char>();
-    message.ref.content = content.toNativeUtf8().cast<ffi.Char>();
+  /// The message and its strings are allocated with [allocator], pass an [Arena] to release them together.
+  ffi.Pointer<llama_chat_message> toNative([ffi.Allocator allocator = calloc]) {
+    final message = allocator<llama_chat_message>();
+    message.ref.role = role.toNativeUtf8(allocator: allocator).cast<ffi.Char>();
+    message.ref.content = content.toNativeUtf8(allocator: allocator).cast<ffi.Char>();
 
-    return message.ref;
+    return message;
   }
 }
 
 extension ChatMessages on List<ChatMessage> {
-  ffi.Pointer<llama_chat_message> toNative() {
-    final messages = calloc<llama_chat_message>(length);
+  /// The array and its strings are allocated with [allocator], pass an [Arena] to release them together.
+  ffi.Pointer<llama_chat_message> toNative([ffi.Allocator allocator = calloc]) {
+    final messages = allocator<llama_chat_message>(length);
 
     for (var i = 0; i < length; i++) {
-      messages[i] = this[i].toNative();
+      messages[i].role = this[i].role.toNativeUtf8(allocator: allocator).cast<ffi.Char>();
+      messages[i].content = this[i].content.toNativeUtf8(allocator: allocator).cast<ffi.Char>();
     }
 
     return messages;
@@ -11,7 +11,9 @@ class ContextParams {
   // physical maximum batch size
   int? nUBatch;
 
-  // max number of sequences (i.e. distinct states for recurrent models)
+  // max number of sequences (i.e. distinct states for recurrent models). More than 1 starts the batching
+  // server, otherwise the context is created with at least 8 so that score() can evaluate candidates
+  // on copies of the conversation
   int? nSeqMax;
 
   // number of threads to use for generation
@@ -20,6 +22,12 @@ class ContextParams {
   // number of threads to use for batch processing
   int? nThreadsBatch;
 
+  // threadpool for generation, shared with every context asking for the same params, overrides nThreads
+  ThreadpoolParams? threadpool;
+
+  // threadpool for batch processing, null = use [threadpool], overrides nThreadsBatch
+  ThreadpoolParams? threadpoolBatch;
+
   // RoPE scaling type, from `enum llama_rope_scaling_type`
   RopeScalingType? ropeScalingType;
 
@@ -71,6 +79,10 @@ class ContextParams {
   // whether to measure performance timings
   bool? noPerformance;
 
+  // bytes the weights, KV cache and compute buffers may take together. When set, LlamaCPP plans
+  // nCtx, typeK, typeV and nBatch with MemoryPlanner before loading, keeping those already set
+  int? memoryBudget;
+
   ContextParams({
     this.nCtx,
     this.nBatch,
@@ -78,6 +90,8 @@ class ContextParams {
     this.nSeqMax,
     this.nThreads,
     this.nThreadsBatch,
+    this.threadpool,
+    this.threadpoolBatch,
     this.ropeScalingType,
     this.poolingType,
     this.attentionType,
@@ -95,6 +109,7 @@ class ContextParams {
     this.offloadKqv,
     this.flashAttention,
     this.noPerformance,
+    this.memoryBudget,
   });
 
   llama_context_params toNative() {
@@ -124,6 +139,14 @@ class ContextParams {
       contextParams.n_threads_batch = nThreadsBatch!;
     }
 
+    if (threadpool != null) {
+      contextParams.n_threads = threadpool!.nThreads;
+    }
+
+    if ((threadpoolBatch ?? threadpool) != null) {
+      contextParams.n_threads_batch = (threadpoolBatch ?? threadpool)!.nThreads;
+    }
+
     if (ropeScalingType != null) {
       contextParams.rope_scaling_type = ropeScalingType!.index;
     }
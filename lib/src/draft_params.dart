@@ -0,0 +1,29 @@
+part of '../lcpp.dart';
+
+class DraftParams {
+  // path of a small model sharing the vocab of the model it drafts for, null for prompt lookup
+  String? modelPath;
+
+  // maximum number of tokens drafted per step
+  int? draftLength;
+
+  // drafting stops at the first token the draft model predicts with a lower probability
+  double? minProbability;
+
+  // shortest and longest n-gram prompt lookup matches against the history
+  int? minNgram;
+  int? maxNgram;
+
+  DraftParams(String this.modelPath, {
+    this.draftLength,
+    this.minProbability,
+  });
+
+  // Drafts the tokens that followed the last earlier occurrence of the end of the conversation,
+  // which pays off when replies copy from the prompt, without a draft model
+  DraftParams.promptLookup({
+    this.draftLength,
+    this.minNgram,
+    this.maxNgram,
+  });
+}
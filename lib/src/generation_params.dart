@@ -0,0 +1,43 @@
+part of '../lcpp.dart';
+
+class GenerationParams {
+  // number of generated tokens buffered before the text is sent, 0 = no limit
+  int? flushTokens;
+
+  // milliseconds since the last message after which buffered text is sent, 0 = no limit
+  int? flushMilliseconds;
+
+  // bytes of text and number of token ids held by a ring buffer shared with the inference isolate,
+  // null = send the text through isolate messages. Not used when prompts are batched together
+  int? ringBufferSize;
+
+  // tokens at the start of the context (e.g. the system prompt) kept when it fills up, the oldest half of
+  // the rest is then discarded and generation continues, null = stop with 'Context size exceeded'.
+  // Not used when prompts are batched together
+  int? nKeep;
+
+  GenerationParams({
+    this.flushTokens,
+    this.flushMilliseconds,
+    this.ringBufferSize,
+    this.nKeep,
+  });
+
+  lcpp_generate_params toNative() {
+    final lcpp_generate_params generateParams = LlamaCPP.native.lcpp_generate_default_params();
+
+    if (flushTokens != null) {
+      generateParams.n_flush_tokens = flushTokens!;
+    }
+
+    if (flushMilliseconds != null) {
+      generateParams.t_flush_ms = flushMilliseconds!.toDouble();
+    }
+
+    if (nKeep != null) {
+      generateParams.n_keep = nKeep!;
+    }
+
+    return generateParams;
+  }
+}
@@ -5,32 +5,199 @@ typedef InitIsolateArguments = ({
   ModelParams modelParams,
   ContextParams contextParams,
   SamplingParams samplingParams,
+  GenerationParams generationParams,
+  DraftParams? draftParams,
+  int streamAddress,
+  int loadCancelAddress,
   SendPort sendPort
 });
 
-typedef PromptIsolateArguments = ({
+typedef InitIsolateResponse = ({
+  SendPort commandPort,
+  int stopFlagAddress,
+  String backends
+});
+
+typedef PrefillProgress = ({
+  int decoded,
+  int total,
+  double percent,
+  double tokensPerSecond
+});
+
+typedef PromptStats = ({
+  int promptTokens,
+  int cachedTokens,
+  int generatedTokens,
+  double prefillMilliseconds,
+  double decodeMilliseconds,
+  double tokensPerSecond,
+  double samplingMilliseconds,
+  double detokenizeMilliseconds,
+  double messagingMilliseconds,
+  double totalMilliseconds
+});
+
+typedef DraftStats = ({
+  int drafted,
+  int accepted,
+  double acceptanceRate
+});
+
+typedef TokenLogprobs = ({
+  int token,
+  double logprob,
+  List<int> topTokens,
+  List<double> topLogprobs
+});
+
+typedef PromptCommand = ({
   List<ChatMessage> messages,
-  int contextLength,
+  SamplingParams? samplingParams,
+  Map<String, double>? loras,
+  int? topLogprobs,
+  SendPort sendPort
+});
+
+typedef ScoreCommand = ({
+  List<ChatMessage> messages,
+  List<String> candidates,
+  SendPort sendPort
+});
+
+typedef CandidateScore = ({
+  List<double> logprobs,
+  double total
+});
+
+typedef EmbedCommand = ({
+  List<String> inputs,
+  bool normalize,
   SendPort sendPort
 });
 
+typedef EmbedResponse = ({
+  int address,
+  int count,
+  int dimensions
+});
+
+typedef LoraCommand = ({
+  Map<String, double> loras,
+  SendPort sendPort
+});
+
+typedef SessionCommand = ({
+  String path,
+  bool save,
+  SendPort sendPort
+});
+
+enum IsolateCommand {
+  stop,
+  clear,
+  dispose;
+}
+
+typedef ModelRegistryStats = ({
+  int models,
+  int references,
+  int loads,
+  int hits,
+  int bytes,
+  double loadMilliseconds
+});
+
 typedef PromptResponse = ({
   String message, 
   bool done
 });
 
 class LlamaCPP {
-  static Completer? _completer;
-  static late SendPort _sendPort;
+  // State owned by the instance in the calling isolate
+  final Completer<SendPort> _commandPort = Completer();
+  final List<Completer> _prompts = [];
+  final bool _concurrent;
+  ffi.Pointer<ffi.Bool>? _stopFlag;
+  int _stops = 0;
+  void Function(String)? _log;
+
+  // Ring buffer the inference isolate writes the output to, read here when notified
+  ffi.Pointer<lcpp_stream>? _stream;
+  ffi.NativeCallable<lcpp_stream_callbackFunction>? _streamCallback;
+  ffi.Pointer<ffi.Pointer<ffi.Char>>? _peekText;
+  ffi.Pointer<ffi.Pointer<llama_token>>? _peekTokens;
+  _StreamReader? _reader;
 
   static lcpp? _lib;
+  static lcpp? _native;
+
+  // State owned by the inference isolate, which lives as long as the instance
+  static late SendPort _sendPort;
+  static ffi.Pointer<ffi.Bool> _stop = ffi.nullptr;
   static ffi.Pointer<llama_model>? _model;
   static ffi.Pointer<llama_context>? _context;
+
+  // Context embeddings are computed in, so they neither touch the conversation's KV cache nor wait for
+  // the batching server. Created on first use
+  static const _embedSequences = 8;
+  static late ContextParams _contextParams;
+  static ffi.Pointer<llama_context>? _embedContext;
   static ffi.Pointer<llama_sampler>? _sampler;
 
-  static int _contextLength = 0;
+  // Sampler chains keyed by their params, least recently used first. A prompt resets and reuses
+  // the chain matching its params instead of building one
+  static const _samplerPoolSize = 8;
+  static late SamplingParams _samplingParams;
+  static final Map<SamplingParams, ffi.Pointer<llama_sampler>> _samplers = {};
+
+  // Sequences of the context when prompts are not batched, all but the conversation's score candidates
+  static const _scoreSequences = 8;
+
+  // Small model drafting tokens for the main one to verify
+  static ffi.Pointer<llama_model>? _draftModel;
+  static ffi.Pointer<llama_context>? _draftContext;
+  static ffi.Pointer<lcpp_draft> _draft = ffi.nullptr;
+
+  // LoRA adapters from the native registry by path, the instance's default scales and the ones set
+  // on the context
+  static final Map<String, ffi.Pointer<llama_adapter_lora>> _adapters = {};
+  static Map<String, double> _loras = {};
+  static Map<String, double> _activeLoras = {};
+
+  // Threadpools from the native registry, shared with other contexts created with the same params
+  static ffi.Pointer<ggml_threadpool> _threadpool = ffi.nullptr;
+  static ffi.Pointer<ggml_threadpool> _threadpoolBatch = ffi.nullptr;
+
+  // Background page cache warm-up of the model's files and the state followed while loading
+  static ffi.Pointer<lcpp_prefetch> _prefetch = ffi.nullptr;
+  static SendPort? _loadSendPort;
+  static ffi.Pointer<ffi.Bool> _loadCancel = ffi.nullptr;
+  static double _loadProgress = 0;
+
+  // Tokens currently held in the KV cache for sequence 0
+  static ffi.Pointer<llama_token> _cache = ffi.nullptr;
+  static ffi.Pointer<ffi.Int32> _nCache = ffi.nullptr;
+
+  static GenerationParams _generationParams = GenerationParams();
+  static ffi.Pointer<lcpp_stream> _outputStream = ffi.nullptr;
+  static final StringBuffer _output = StringBuffer();
+  static ffi.Pointer<lcpp_generate_timings> _timings = ffi.nullptr;
+
+  // Reused for every prompt so native memory stays flat over a session
+  static final ScratchPool _scratch = ScratchPool();
+
+  // Rendered and tokenized history of the last prompt, so a new turn only processes the new messages
+  static final ChatCache _chat = ChatCache(_scratch);
 
-  static void Function(String)? _log;
+  // Continuous batching server, used when the context has more than one sequence
+  static const _readBufferSize = 4096;
+  static ffi.Pointer<lcpp_server>? _server;
+  static ffi.NativeCallable<lcpp_server_callbackFunction>? _serverCallback;
+  static final Map<int, ({SendPort sendPort, StringBuffer output})> _requests = {};
+  static ffi.Pointer<ffi.Char> _readBuffer = ffi.nullptr;
+  static ffi.Pointer<ffi.Bool> _readDone = ffi.nullptr;
+  static ffi.Pointer<ffi.Int32> _readStatus = ffi.nullptr;
 
   /// Getter for the Llama library.
   ///
@@ -53,246 +220,1319 @@ class LlamaCPP {
     return _lib!;
   }
 
-  LlamaCPP(String modelPath, ModelParams modelParams, ContextParams contextParams, SamplingParams samplingParams, {void Function(String)? log}) {
+  /// Getter for the native helper library built from `src/lcpp.cpp`.
+  ///
+  /// Loads the library based on the current platform.
+  static lcpp get native {
+    if (_native == null) {
+      if (Platform.isWindows) {
+        _native = lcpp(ffi.DynamicLibrary.open('lcpp.dll'));
+      } 
+      else if (Platform.isLinux || Platform.isAndroid) {
+        _native = lcpp(ffi.DynamicLibrary.open('liblcpp.so'));
+      } 
+      else if (Platform.isMacOS || Platform.isIOS) {
+        _native = lcpp(ffi.DynamicLibrary.open('lcpp.framework/lcpp'));
+      } 
+      else {
+        throw Exception('Unsupported platform');
+      }
+    }
+    return _native!;
+  }
+
+  /// Statistics of the process-wide registry that shares loaded models between instances.
+  static ModelRegistryStats get modelRegistryStats {
+    final stats = native.lcpp_model_registry_get_stats();
+
+    return (
+      models: stats.n_models,
+      references: stats.n_refs,
+      loads: stats.n_loads,
+      hits: stats.n_hits,
+      bytes: stats.n_bytes,
+      loadMilliseconds: stats.t_load_ms
+    );
+  }
+
+  /// Creates an instance whose inference isolate owns the model, context and sampler.
+  ///
+  /// When [ContextParams.nSeqMax] is greater than one, prompts are not queued
+  /// behind each other but decoded together by a continuous batching server,
+  /// each in its own sequence.
+  ///
+  /// [generationParams] controls how generated text is batched into stream
+  /// events, by default every token is sent as soon as its text is complete.
+  /// With [GenerationParams.ringBufferSize] the text and token ids are read
+  /// from native memory shared with the inference isolate instead of being
+  /// copied into isolate messages.
+  ///
+  /// With [draftParams], a small model sharing the vocab of the main one
+  /// drafts tokens that the main model verifies in a single decode. Its
+  /// acceptance rate is reported to [prompt]'s `onDraftStats`.
+  /// [DraftParams.promptLookup] drafts by copying from the conversation
+  /// instead, without a second model in memory.
+  ///
+  /// [onLoadProgress] follows the model load, returning false from it
+  /// cancels the load and the instance then fails to initialize.
+  LlamaCPP(String modelPath, ModelParams modelParams, ContextParams contextParams, SamplingParams samplingParams, {GenerationParams? generationParams, DraftParams? draftParams, OnProgressCallback? onLoadProgress, void Function(String)? log})
+      : _concurrent = (contextParams.nSeqMax ?? 1) > 1 {
     _log = log;
 
     _log?.call('Initializing LLM');
 
     final receivePort = ReceivePort();
 
-    _completer = Completer();
+    final ringBufferSize = generationParams?.ringBufferSize;
+    if (ringBufferSize != null && !_concurrent) {
+      _streamCallback = ffi.NativeCallable<lcpp_stream_callbackFunction>.listener(_onStream);
+      _stream = native.lcpp_stream_init(ringBufferSize, ringBufferSize, _streamCallback!.nativeFunction, ffi.nullptr);
+      _peekText = calloc<ffi.Pointer<ffi.Char>>();
+      _peekTokens = calloc<ffi.Pointer<llama_token>>();
+    }
+
+    // Progress is reported asynchronously, so the answer to it goes back through native memory
+    final loadCancel = onLoadProgress != null ? calloc<ffi.Bool>() : null;
 
     final initParams = (
       modelPath: modelPath,
       modelParams: modelParams,
       contextParams: contextParams,
       samplingParams: samplingParams,
+      generationParams: generationParams ?? GenerationParams(),
+      draftParams: draftParams,
+      streamAddress: _stream?.address ?? 0,
+      loadCancelAddress: loadCancel?.address ?? 0,
       sendPort: receivePort.sendPort
     );
 
-    Isolate.spawn(_initIsolate, initParams).then((value) async {
+    // The isolate keeps the model, context and sampler for the life of this instance
+    Isolate.spawn(_initIsolate, initParams).then((_) {
       receivePort.listen((data) {
-        if (data is String) {
-          _log?.call(data);
+        // Load progress comes before the init response
+        if (data is double) {
+          if (!onLoadProgress!(data)) {
+            loadCancel!.value = true;
+          }
 
-          _completer!.completeError(Exception(data));
+          return;
         }
-        else {
-          _completer!.complete();
+
+        receivePort.close();
+        if (loadCancel != null) {
+          calloc.free(loadCancel);
         }
-      });
 
-      await _completer!.future;
+        _onInit(data);
+      });
     });
   }
 
-  Stream<String> prompt(List<ChatMessage> messages) async* {   
+  void _onInit(dynamic data) {
+    if (data is InitIsolateResponse) {
+      _log?.call(data.backends);
+      _stopFlag = ffi.Pointer<ffi.Bool>.fromAddress(data.stopFlagAddress);
+      _commandPort.complete(data.commandPort);
+    }
+    else {
+      _log?.call(data.toString());
+      _commandPort.completeError(Exception(data));
+    }
+  }
+
+  /// Streams the reply to [messages].
+  ///
+  /// Long prompts are decoded in chunks of [ContextParams.nBatch] tokens and
+  /// [onProgress] is called after each chunk. [stop] cancels between chunks.
+  ///
+  /// Once the reply is complete, [onStats] receives where its time went.
+  /// Prefill and decode times are measured by the generation loop, the decode
+  /// time includes drafting and draft verification. The sampling time comes
+  /// from the llama.cpp performance counters, so it is zero with
+  /// [ContextParams.noPerformance].
+  ///
+  /// When the output goes through a ring buffer, [onTokens] receives the ids
+  /// of the generated tokens as a view of native memory that is only valid
+  /// during the call.
+  ///
+  /// [samplingParams] replaces the constructor's sampling params for this prompt only.
+  ///
+  /// [loras] replaces the instance's LoRA adapters for this prompt only.
+  /// Changing adapters invalidates the KV cache, so the conversation is
+  /// decoded in full and again by the next prompt using other adapters.
+  ///
+  /// [onLogprobs] receives the log-probability of every generated token under
+  /// the model's distribution before sampling, along with the [topLogprobs]
+  /// most likely tokens at its position. It is not called when prompts are
+  /// batched together.
+  Stream<String> prompt(List<ChatMessage> messages, {SamplingParams? samplingParams, void Function(PrefillProgress)? onProgress, void Function(Int32List)? onTokens, void Function(DraftStats)? onDraftStats, void Function(PromptStats)? onStats, Map<String, double>? loras, int topLogprobs = 0, void Function(TokenLogprobs)? onLogprobs}) async* {   
     // Ensure initialization is complete
-    await _completer?.future;
-    _completer = Completer();
+    final commandPort = await _commandPort.future;
 
-    final receivePort = ReceivePort();
+    final previous = _prompts.lastOrNull;
+    final completer = Completer();
+    _prompts.add(completer);
 
-    final promptParams = (
-      messages: messages,
-      contextLength: _contextLength,
-      sendPort: receivePort.sendPort
-    );
+    final stops = _stops;
 
-    final isolate = await Isolate.spawn(_promptIsolate, promptParams);
+    // Wait for the previous prompt to finish unless the server decodes them together
+    if (!_concurrent) {
+      await previous?.future;
+    }
 
-    await for (var data in receivePort) {
+    final receivePort = ReceivePort();
+    final controller = StreamController<String>();
+
+    if (_stream != null) {
+      _reader = _StreamReader(controller, onTokens);
+    }
+
+    // The prompt is only released once the inference isolate is done with it,
+    // even if the stream is cancelled earlier
+    receivePort.listen((data) {
       if (data is PromptResponse) {
-        if (data.done) {
-          receivePort.close();
-          isolate.kill();
-          _completer?.complete();
+        if (!data.done) {
+          controller.add(data.message);
           return;
         }
 
-        yield data.message;
+        // Everything was written to the ring buffer before done was sent
+        _onStream(ffi.nullptr);
+        _reader?.close();
+        _reader = null;
+
+        receivePort.close();
+        controller.close();
+        _prompts.remove(completer);
+        completer.complete();
       } 
-      else if (data is SendPort) {
-        _sendPort = data;
+      else if (data is PrefillProgress) {
+        onProgress?.call(data);
+      }
+      else if (data is DraftStats) {
+        onDraftStats?.call(data);
+      }
+      else if (data is PromptStats) {
+        onStats?.call(data);
+      }
+      else if (data is TokenLogprobs) {
+        onLogprobs?.call(data);
       }
       else if (data is String) {
         _log?.call(data);
       }
+    });
+
+    // The flag is only cleared here, the isolate may still be busy with an earlier command when a stop
+    // for this prompt arrives. A stop since this prompt was queued leaves it set, so it ends right away
+    if (!_concurrent && _stops == stops) {
+      _stopFlag?.value = false;
+    }
+
+    commandPort.send((
+      messages: messages,
+      samplingParams: samplingParams,
+      loras: loras,
+      topLogprobs: onLogprobs != null ? topLogprobs : null,
+      sendPort: receivePort.sendPort
+    ));
+
+    try {
+      yield* controller.stream;
+    } finally {
+      // Nobody reads the ring buffer anymore, so the generation would wait on it
+      if (_stream != null && !completer.isCompleted) {
+        _stopFlag?.value = true;
+      }
     }
   }
 
+  void _onStream(ffi.Pointer<ffi.Void> userData) {
+    final reader = _reader;
+    if (reader == null) {
+      return;
+    }
+
+    while (true) {
+      final length = native.lcpp_stream_peek_text(_stream!, _peekText!);
+      if (length == 0) {
+        break;
+      }
+
+      reader.addText(_peekText!.value.cast<ffi.Uint8>().asTypedList(length));
+      native.lcpp_stream_consume_text(_stream!, length);
+    }
+
+    while (true) {
+      final count = native.lcpp_stream_peek_tokens(_stream!, _peekTokens!);
+      if (count == 0) {
+        break;
+      }
+
+      reader.onTokens?.call(_peekTokens!.value.asTypedList(count));
+      native.lcpp_stream_consume_tokens(_stream!, count);
+    }
+
+    reader.flush();
+  }
+
   static void _initIsolate(InitIsolateArguments args) {
-    _sendPort = args.sendPort;
-    
     try {
-      lib.ggml_backend_load_all();
+      // Planned from the model's metadata, before its weights are loaded
+      if (args.contextParams.memoryBudget != null) {
+        _planMemory(args.modelPath, args.modelParams, args.contextParams);
+      }
 
       final modelParams = args.modelParams.toNative();
+      final modelPath = args.modelPath.toNativeUtf8();
+
+      // Runs alongside the load, which only maps the file, and keeps going after it
+      if (args.modelParams.prefetch == true && modelParams.use_mmap) {
+        _prefetch = native.lcpp_prefetch_start(modelPath.cast<ffi.Char>());
+      }
+
+      if (args.loadCancelAddress != 0) {
+        _loadSendPort = args.sendPort;
+        _loadCancel = ffi.Pointer<ffi.Bool>.fromAddress(args.loadCancelAddress);
+        modelParams.progress_callback = ffi.Pointer.fromFunction<llama_progress_callbackFunction>(_onLoadProgress, false);
+      }
+
+      if (args.modelParams.numa != null) {
+        native.lcpp_numa_init(args.modelParams.numa!.index);
+      }
       
-      _model = lib.llama_load_model_from_file(
-        args.modelPath.toNativeUtf8().cast<ffi.Char>(), 
+      // Instances loading the same file share one model through the native registry
+      _model = native.lcpp_model_acquire(
+        modelPath.cast<ffi.Char>(), 
         modelParams
       );
-      assert(_model != null && _model != ffi.nullptr, 'Failed to load model');
+
+      malloc.free(modelPath);
+      if (_model == ffi.nullptr) {
+        throw Exception(_loadCancel != ffi.nullptr && _loadCancel.value ? 'Model load cancelled' : 'Failed to load model');
+      }
+
+      // A model shared through the registry was loaded before, so no progress was reported for it
+      if (_loadSendPort != null && _loadProgress < 1.0) {
+        _loadSendPort!.send(1.0);
+      }
+
+      // The main isolate frees the flag once it has the init response, and the params are reused
+      // for the draft model, whose load is not the one followed
+      _loadCancel = ffi.nullptr;
+      _loadSendPort = null;
+      modelParams.progress_callback = ffi.nullptr;
+      modelParams.progress_callback_user_data = ffi.nullptr;
 
       final contextParams = args.contextParams.toNative();
 
+      // Only more than one sequence asked for starts the batching server, otherwise the spare
+      // sequences hold copies of the conversation that score evaluates candidates on
+      final batched = contextParams.n_seq_max > 1;
+      if (!batched) {
+        contextParams.n_seq_max = max(contextParams.n_seq_max, _scoreSequences);
+      }
+
       _context = lib.llama_init_from_model(_model!, contextParams);
-      assert(_context != null && _context != ffi.nullptr, 'Failed to initialize context');
+      if (_context == ffi.nullptr) {
+        throw Exception('Failed to initialize context');
+      }
+
+      if (args.contextParams.threadpool != null) {
+        _initThreadpools(args.contextParams.threadpool!, args.contextParams.threadpoolBatch);
+      }
+
+      _contextParams = args.contextParams;
+
+      _samplingParams = args.samplingParams;
+      _sampler = _samplerFor(null);
 
-      final vocab = lib.llama_model_get_vocab(_model!);
-      _sampler = args.samplingParams.toNative(vocab);
-      assert(_sampler != null && _sampler != ffi.nullptr, 'Failed to initialize sampler');
+      _generationParams = args.generationParams;
+      _outputStream = ffi.Pointer<lcpp_stream>.fromAddress(args.streamAddress);
+
+      // Generation blocks this isolate's event loop, so stop requests are passed through native memory
+      _stop = calloc<ffi.Bool>();
+
+      _cache = calloc<llama_token>(lib.llama_n_ctx(_context!));
+      _nCache = calloc<ffi.Int32>();
+      _timings = calloc<lcpp_generate_timings>();
+
+      _loras = args.modelParams.loras ?? {};
+      _applyLoras(_loras);
+
+      if (args.draftParams != null && !batched) {
+        _initDraft(args.draftParams!, modelParams);
+      }
+
+      if (batched) {
+        // The server thread notifies this isolate, which stays free to accept prompts
+        _serverCallback = ffi.NativeCallable<lcpp_server_callbackFunction>.listener(_onServerText);
+        _server = native.lcpp_server_init(_context!, _serverCallback!.nativeFunction, ffi.nullptr);
+        if (_server == ffi.nullptr) {
+          throw Exception('Failed to start the batching server');
+        }
 
-      args.sendPort.send(null);
+        _readBuffer = calloc<ffi.Char>(_readBufferSize);
+        _readDone = calloc<ffi.Bool>();
+        _readStatus = calloc<ffi.Int32>();
+      }
+
+      final commandPort = ReceivePort();
+      commandPort.listen(_onCommand);
+
+      args.sendPort.send((
+        commandPort: commandPort.sendPort,
+        stopFlagAddress: _stop.address,
+        backends: _backendInfo()
+      ));
     } catch (e) {
+      // The model stays in the process-wide registry as long as it is referenced
+      _release();
+
       args.sendPort.send(e.toString());
     }
   }
 
-  static void _promptIsolate(PromptIsolateArguments args) {
-    _sendPort = args.sendPort;
-    _completer = Completer();
-    _stopListener();
+  // Called by llama.cpp on this isolate's thread during the load, at most every percent is sent
+  static bool _onLoadProgress(double progress, ffi.Pointer<ffi.Void> userData) {
+    if (progress >= 1.0 || progress - _loadProgress >= 0.01) {
+      _loadProgress = progress;
+      _loadSendPort!.send(progress);
+    }
 
-    try {
-      final nCtx = lib.llama_n_ctx(_context!);
+    return !_loadCancel.value;
+  }
 
-      ffi.Pointer<ffi.Char> formatted = calloc<ffi.Char>(nCtx);
+  static void _planMemory(String modelPath, ModelParams modelParams, ContextParams contextParams) {
+    final path = modelPath.toNativeUtf8();
+    final weightsLoaded = native.lcpp_model_is_loaded(path.cast<ffi.Char>(), modelParams.toNative());
+    malloc.free(path);
 
-      final template = lib.llama_model_chat_template(_model!, ffi.nullptr);
+    final plan = MemoryPlanner.fromFile(modelPath).plan(contextParams.memoryBudget!, contextParams, weightsLoaded);
+    if (plan == null) {
+      throw Exception('Model does not fit in the memory budget');
+    }
 
-      final messages = args.messages;
+    contextParams
+      ..nCtx = plan.nCtx
+      ..typeK = plan.typeK
+      ..typeV = plan.typeV
+      ..nBatch = plan.nBatch;
+  }
 
-      int newContextLength = lib.llama_chat_apply_template(
-        template, 
-        messages.toNative(), 
-        messages.length, 
-        true, 
-        formatted, 
-        nCtx
+  /// The devices the loaded backends run on, including the CPU variant picked for this host.
+  static String _backendInfo() {
+    final length = native.lcpp_backend_info(ffi.nullptr, 0);
+    final info = _scratch.text(length + 1);
+
+    native.lcpp_backend_info(info, length + 1);
+
+    return info.cast<Utf8>().toDartString(length: length).trimRight();
+  }
+
+  static void _initThreadpools(ThreadpoolParams threadpoolParams, ThreadpoolParams? threadpoolBatchParams) {
+    final params = threadpoolParams.toNative();
+    _threadpool = native.lcpp_threadpool_acquire(params);
+    calloc.free(params);
+
+    if (threadpoolBatchParams != null) {
+      final batchParams = threadpoolBatchParams.toNative();
+      _threadpoolBatch = native.lcpp_threadpool_acquire(batchParams);
+      calloc.free(batchParams);
+    }
+
+    if (_threadpool == ffi.nullptr || (threadpoolBatchParams != null && _threadpoolBatch == ffi.nullptr)) {
+      throw Exception('Failed to create threadpool');
+    }
+
+    // Prompts run on the batch pool when there is one, single tokens always on the generation pool
+    native.lcpp_threadpool_attach(
+      _context!, 
+      _threadpool, 
+      _threadpoolBatch == ffi.nullptr ? _threadpool : _threadpoolBatch
+    );
+  }
+
+  static ffi.Pointer<llama_adapter_lora> _adapterFor(String path) {
+    final cached = _adapters[path];
+    if (cached != null) {
+      return cached;
+    }
+
+    final nativePath = path.toNativeUtf8();
+    final adapter = native.lcpp_adapter_acquire(_model!, nativePath.cast<ffi.Char>());
+    malloc.free(nativePath);
+
+    if (adapter == ffi.nullptr) {
+      throw Exception('Failed to load LoRA adapter $path');
+    }
+
+    _adapters[path] = adapter;
+    return adapter;
+  }
+
+  // Sets exactly the adapters of [loras] on the context. The KV cache was computed with the previous
+  // ones, so it is no longer reused once they change
+  static void _applyLoras(Map<String, double> loras) {
+    if (loras.length == _activeLoras.length && loras.entries.every((lora) => _activeLoras[lora.key] == lora.value)) {
+      return;
+    }
+
+    _nCache.value = 0;
+    lib.llama_clear_adapter_lora(_context!);
+    _activeLoras = {};
+
+    for (final lora in loras.entries) {
+      if (lib.llama_set_adapter_lora(_context!, _adapterFor(lora.key), lora.value) != 0) {
+        lib.llama_clear_adapter_lora(_context!);
+        throw Exception('Failed to set LoRA adapter ${lora.key}');
+      }
+    }
+
+    _activeLoras = Map.of(loras);
+  }
+
+  static void _initDraft(DraftParams draftParams, llama_model_params modelParams) {
+    if (draftParams.modelPath == null) {
+      _draft = native.lcpp_draft_init_ngram(
+        draftParams.draftLength ?? 10,
+        draftParams.minNgram ?? 2,
+        draftParams.maxNgram ?? 4
       );
 
-      if (newContextLength > nCtx) {
-        formatted = calloc<ffi.Char>(newContextLength);
-        newContextLength = lib.llama_chat_apply_template(
-          template, 
-          messages.toNative(), 
-          messages.length, 
-          true, 
-          formatted, 
-          newContextLength
-        );
+      if (_draft == ffi.nullptr) {
+        throw Exception('Invalid prompt lookup params');
       }
 
-      if (newContextLength < 0) {
-        _sendPort.send('Failed to apply template');
-        return;
+      return;
+    }
+
+    final modelPath = draftParams.modelPath!.toNativeUtf8();
+
+    _draftModel = native.lcpp_model_acquire(
+      modelPath.cast<ffi.Char>(), 
+      modelParams
+    );
+
+    malloc.free(modelPath);
+    if (_draftModel == ffi.nullptr) {
+      throw Exception('Failed to load draft model');
+    }
+
+    // Drafted tokens are compared by id, so both models must tokenize alike
+    if (!native.lcpp_vocab_compatible(_model!, _draftModel!)) {
+      throw Exception('Draft model vocab is not compatible with the model');
+    }
+
+    // The draft mirrors the target's history but decodes at most a draft step at a time, so only its
+    // context length is taken from the target
+    final draftLength = draftParams.draftLength ?? 16;
+
+    final contextParams = _contextParams.toNative();
+    contextParams.n_ctx = lib.llama_n_ctx(_context!);
+    contextParams.n_batch = draftLength + 1;
+    contextParams.n_ubatch = draftLength + 1;
+    contextParams.n_seq_max = 1;
+
+    _draftContext = lib.llama_init_from_model(_draftModel!, contextParams);
+    if (_draftContext == ffi.nullptr) {
+      throw Exception('Failed to initialize draft context');
+    }
+
+    // Sharing the threadpools keeps the draft from competing with the target for cores
+    if (_threadpool != ffi.nullptr) {
+      native.lcpp_threadpool_attach(
+        _draftContext!, 
+        _threadpool, 
+        _threadpoolBatch == ffi.nullptr ? _threadpool : _threadpoolBatch
+      );
+    }
+
+    _draft = native.lcpp_draft_init(
+      _draftContext!, 
+      draftLength, 
+      draftParams.minProbability ?? 0.75
+    );
+  }
+
+  /// The pooled chain for [params], or the constructor's params when null, reset to a fresh state.
+  static ffi.Pointer<llama_sampler> _samplerFor(SamplingParams? params) {
+    final key = params ?? _samplingParams;
+    var sampler = _samplers.remove(key);
+
+    if (sampler != null && key.grammar == null && key.jsonSchema == null) {
+      // Mirostat, penalties and DRY state must not carry over from the previous prompt
+      lib.llama_sampler_reset(sampler);
+    }
+    else if (sampler != null) {
+      // Resetting a grammar sampler parses its grammar again, a new chain clones it from the native cache
+      lib.llama_sampler_free(sampler);
+      sampler = key.toNative(lib.llama_model_get_vocab(_model!));
+    }
+    else {
+      sampler = key.toNative(lib.llama_model_get_vocab(_model!));
+
+      if (_samplers.length >= _samplerPoolSize) {
+        lib.llama_sampler_free(_samplers.remove(_samplers.keys.first)!);
       }
+    }
 
-      final prompt = formatted.cast<Utf8>().toDartString().substring(_contextLength);
+    _samplers[key] = sampler;
+    return sampler;
+  }
 
-      final finalOutput = _generate(prompt);
+  static void _onCommand(dynamic command) {
+    if (command is PromptCommand) {
+      if (_server != null) {
+        _submit(command);
+      }
+      else {
+        _prompt(command);
+      }
+    }
+    else if (command is EmbedCommand) {
+      _embed(command);
+    }
+    else if (command is ScoreCommand) {
+      _score(command);
+    }
+    else if (command is SessionCommand) {
+      _session(command);
+    }
+    else if (command is LoraCommand) {
+      _setLoras(command);
+    }
+    else if (command == IsolateCommand.stop) {
+      for (final id in _requests.keys) {
+        native.lcpp_server_cancel(_server!, id);
+      }
+    }
+    else if (command == IsolateCommand.clear) {
+      if (_server == null) {
+        lib.llama_kv_cache_clear(_context!);
+        _nCache.value = 0;
+      }
+    }
+    else if (command == IsolateCommand.dispose) {
+      _release();
+      Isolate.exit();
+    }
+  }
 
-      messages.add(ChatMessage(
-        role: 'assistant',
-        content: finalOutput
-      ));
+  // Frees everything the isolate acquired in reverse order, also when it failed to initialize halfway
+  static void _release() {
+    if (_server != null && _server != ffi.nullptr) {
+      native.lcpp_server_free(_server!);
+    }
+
+    _serverCallback?.close();
+
+    for (final buffer in [_readBuffer, _readDone, _readStatus]) {
+      if (buffer != ffi.nullptr) {
+        calloc.free(buffer);
+      }
+    }
+
+    if (_draft != ffi.nullptr) {
+      native.lcpp_draft_free(_draft);
+    }
+
+    if (_draftContext != null && _draftContext != ffi.nullptr) {
+      native.lcpp_threadpool_detach(_draftContext!);
+      lib.llama_free(_draftContext!);
+    }
+
+    if (_draftModel != null && _draftModel != ffi.nullptr) {
+      native.lcpp_model_release(_draftModel!);
+    }
+
+    for (final sampler in _samplers.values) {
+      lib.llama_sampler_free(sampler);
+    }
+
+    if (_embedContext != null) {
+      native.lcpp_threadpool_detach(_embedContext!);
+      lib.llama_free(_embedContext!);
+    }
+
+    if (_context != null && _context != ffi.nullptr) {
+      native.lcpp_threadpool_detach(_context!);
+      lib.llama_free(_context!);
+    }
+
+    if (_threadpool != ffi.nullptr) {
+      native.lcpp_threadpool_release(_threadpool);
+    }
+
+    if (_threadpoolBatch != ffi.nullptr) {
+      native.lcpp_threadpool_release(_threadpoolBatch);
+    }
 
-      _contextLength = lib.llama_chat_apply_template(
+    for (final adapter in _adapters.values) {
+      native.lcpp_adapter_release(adapter);
+    }
+
+    if (_model != null && _model != ffi.nullptr) {
+      native.lcpp_model_release(_model!);
+    }
+
+    if (_prefetch != ffi.nullptr) {
+      native.lcpp_prefetch_free(_prefetch);
+    }
+
+    for (final buffer in [_stop, _cache, _nCache, _timings]) {
+      if (buffer != ffi.nullptr) {
+        calloc.free(buffer);
+      }
+    }
+
+    _chat.dispose();
+    _scratch.dispose();
+  }
+
+  static void _prompt(PromptCommand command) {
+    _sendPort = command.sendPort;
+    _output.clear();
+
+    try {
+      _sampler = _samplerFor(command.samplingParams);
+      _applyLoras(command.loras ?? _loras);
+      final tokens = _chat.tokenize(_model!, command.messages);
+
+      _generate(tokens.tokens, tokens.count, command.topLogprobs);
+    } catch (e) {
+      _sendPort.send(e.toString());
+    } finally {
+      _sendPort.send((message: _output.toString(), done: true));
+    }
+  }
+
+  static ({ffi.Pointer<ffi.Char> text, int length}) _format(List<ChatMessage> messages) {
+    final nCtx = lib.llama_n_ctx(_context!);
+
+    final template = lib.llama_model_chat_template(_model!, ffi.nullptr);
+
+    final chat = _scratch.messages(messages);
+
+    // The whole conversation is rendered, the KV cache decides what actually needs decoding
+    int length = lib.llama_chat_apply_template(
+      template, 
+      chat, 
+      messages.length, 
+      true, 
+      _scratch.text(nCtx), 
+      nCtx
+    );
+
+    if (length > nCtx) {
+      length = lib.llama_chat_apply_template(
         template, 
-        messages.toNative(), 
+        chat, 
         messages.length, 
-        false, 
-        ffi.nullptr, 
-        0
+        true, 
+        _scratch.text(length), 
+        length
       );
+    }
 
-      _sendPort.send((message: finalOutput, done: true));
-    } catch (e) {
-      _sendPort.send(e.toString());
+    if (length < 0) {
+      throw Exception('Failed to apply template');
     }
+
+    return (text: _scratch.text(length), length: length);
   }
 
-  static void _stopListener() async  {
-    final receivePort = ReceivePort();
+  static ({ffi.Pointer<llama_token> tokens, int count}) _tokenize(ffi.Pointer<ffi.Char> text, int length) {
+    final vocab = lib.llama_model_get_vocab(_model!);
 
-    _sendPort.send(receivePort.sendPort);
+    final count = -lib.llama_tokenize(vocab, text, length, ffi.nullptr, 0, true, true);
+    final tokens = _scratch.tokens(count);
 
-    await for (var data in receivePort) {
-      if (data is bool) {
-        receivePort.close();
-        _completer?.complete();
-        return;
-      }
+    if (lib.llama_tokenize(vocab, text, length, tokens, count, true, true) < 0) {
+      throw Exception('Failed to tokenize prompt');
+    }
+
+    return (tokens: tokens, count: count);
+  }
+
+  static void _generate(ffi.Pointer<llama_token> promptTokens, int nPromptTokens, int? topLogprobs) {
+    final stopwatch = Stopwatch()..start();
+
+    final nReused = _reuseCache(promptTokens, nPromptTokens);
+
+    final params = _generationParams.toNative();
+    params.abort = _stop;
+    params.stream = _outputStream;
+    params.draft = _draft;
+    params.timings = _timings;
+
+    _timings.ref
+      ..n_tokens = 0
+      ..n_emits = 0
+      ..t_detokenize_ms = 0
+      ..t_emit_ms = 0
+      ..t_prefill_ms = 0
+      ..t_decode_ms = 0;
+
+    lib.llama_perf_sampler_reset(_sampler!);
+
+    final draftStats = _draft != ffi.nullptr ? native.lcpp_draft_get_stats(_draft) : null;
+    params.text_callback = ffi.Pointer.fromFunction<lcpp_text_callbackFunction>(_onText, false);
+    params.prefill_callback = ffi.Pointer.fromFunction<lcpp_prefill_callbackFunction>(_onPrefill, false);
+    params.history = _cache;
+    params.n_history = _nCache;
+
+    if (topLogprobs != null) {
+      params.probs_callback = ffi.Pointer.fromFunction<lcpp_probs_callbackFunction>(_onProbs);
+      params.n_probs = topLogprobs;
+    }
+
+    // The whole decode / sample / detokenize loop runs natively, text comes back through _onText
+    final status = native.lcpp_generate(_context!, _sampler!, promptTokens + nReused, nPromptTokens - nReused, params);
+
+    final samplerPerf = lib.llama_perf_sampler(_sampler!);
+    final timings = _timings.ref;
+
+    _sendPort.send((
+      promptTokens: nPromptTokens,
+      cachedTokens: nReused,
+      generatedTokens: timings.n_tokens,
+      prefillMilliseconds: timings.t_prefill_ms,
+      decodeMilliseconds: timings.t_decode_ms,
+      tokensPerSecond: timings.t_decode_ms > 0 ? timings.n_tokens * 1000 / timings.t_decode_ms : 0.0,
+      samplingMilliseconds: samplerPerf.t_sample_ms,
+      detokenizeMilliseconds: timings.t_detokenize_ms,
+      messagingMilliseconds: timings.t_emit_ms,
+      totalMilliseconds: stopwatch.elapsedMicroseconds / 1000
+    ));
+
+    if (draftStats != null) {
+      final stats = native.lcpp_draft_get_stats(_draft);
+      final drafted = stats.n_drafted - draftStats.n_drafted;
+      final accepted = stats.n_accepted - draftStats.n_accepted;
+
+      _sendPort.send((
+        drafted: drafted,
+        accepted: accepted,
+        acceptanceRate: drafted > 0 ? accepted / drafted : 0.0
+      ));
+    }
+
+    _sendStatus(_sendPort, status);
+  }
+
+  // Keeps the longest common prefix of the KV cache and drops only the diverging tail,
+  // at least one token has to be decoded to get fresh logits. Returns the number of tokens kept
+  static int _reuseCache(ffi.Pointer<llama_token> promptTokens, int nPromptTokens) {
+    int nReused = 0;
+    while (nReused < _nCache.value && nReused < nPromptTokens && _cache[nReused] == promptTokens[nReused]) {
+      nReused++;
+    }
+
+    if (nReused == nPromptTokens) {
+      nReused--;
+    }
+
+    if (!lib.llama_kv_cache_seq_rm(_context!, 0, nReused, -1)) {
+      // Not every model can remove part of a sequence
+      lib.llama_kv_cache_clear(_context!);
+      nReused = 0;
+    }
+
+    _nCache.value = nReused;
+    return nReused;
+  }
+
+  static void _sendStatus(SendPort sendPort, int status) {
+    final message = _statusMessage(status);
+
+    if (message != null) {
+      sendPort.send(message);
+    }
+  }
+
+  static String? _statusMessage(int status) {
+    switch (status) {
+      case lcpp_status.LCPP_STATUS_CONTEXT_FULL:
+        return 'Context size exceeded';
+      case lcpp_status.LCPP_STATUS_DECODE_FAILED:
+        return 'Failed to decode';
+      case lcpp_status.LCPP_STATUS_DETOKENIZE_FAILED:
+        return 'Failed to convert token to piece';
+      case lcpp_status.LCPP_STATUS_FILE_FAILED:
+        return 'Failed to access session file';
+      case lcpp_status.LCPP_STATUS_SESSION_MISMATCH:
+        return 'Session does not match the model or context';
+      case lcpp_status.LCPP_STATUS_NO_EMBEDDINGS:
+        return 'The context does not pool embeddings';
+      default:
+        return null;
     }
   }
 
-  static String _generate(String prompt) {
-    String finalOutput = '';
+  // Its KV cache only ever holds one batch, decoded as a single ubatch so that every input is pooled whole,
+  // and at least _embedSequences inputs are decoded together
+  static ffi.Pointer<llama_context> _embedContextFor() {
+    if (_embedContext != null) {
+      return _embedContext!;
+    }
+
+    final params = _contextParams.toNative();
+    params.n_ctx = params.n_batch;
+    params.n_ubatch = params.n_batch;
+    params.n_seq_max = max(params.n_seq_max, _embedSequences);
+    params.embeddings = true;
+
+    final context = lib.llama_init_from_model(_model!, params);
+    if (context == ffi.nullptr) {
+      throw Exception('Failed to initialize embedding context');
+    }
+
+    if (_threadpool != ffi.nullptr) {
+      native.lcpp_threadpool_attach(
+        context, 
+        _threadpool, 
+        _threadpoolBatch == ffi.nullptr ? _threadpool : _threadpoolBatch
+      );
+    }
+
+    _embedContext = context;
+    return context;
+  }
+
+  static void _embed(EmbedCommand command) {
+    final ffi.Pointer<llama_context> context;
+
+    try {
+      context = _embedContextFor();
+    } catch (e) {
+      command.sendPort.send(e.toString());
+      return;
+    }
 
     final vocab = lib.llama_model_get_vocab(_model!);
-    final isFirst = lib.llama_get_kv_cache_used_cells(_context!) == 0;
+    final count = command.inputs.length;
+    final dimensions = lib.llama_model_n_embd(_model!);
 
-    final nPromptTokens = lib.llama_tokenize(vocab, prompt.toNativeUtf8().cast<ffi.Char>(), prompt.length, ffi.nullptr, 0, isFirst, true);
-    ffi.Pointer<llama_token> promptTokens = calloc<llama_token>(nPromptTokens);
+    final lengths = calloc<ffi.Int32>(count);
+    int total = 0;
 
-    if (lib.llama_tokenize(vocab, prompt.toNativeUtf8().cast<ffi.Char>(), prompt.length, promptTokens, nPromptTokens, isFirst, true) < 0) {
-      _sendPort.send('Failed to tokenize prompt');
-      return '';
+    for (var i = 0; i < count; i++) {
+      final input = _scratch.string(command.inputs[i]);
+      lengths[i] = -lib.llama_tokenize(vocab, input.text, input.length, ffi.nullptr, 0, true, true);
+      total += lengths[i];
     }
 
-    llama_batch batch = lib.llama_batch_get_one(promptTokens, nPromptTokens);
-    int newTokenId;
-    while (!_completer!.isCompleted) {
-      final nCtx = lib.llama_n_ctx(_context!);
-      final nCtxUsed = lib.llama_get_kv_cache_used_cells(_context!);
+    final tokens = _scratch.tokens(total);
+    int offset = 0;
 
-      if (nCtxUsed + batch.n_tokens > nCtx) {
-        _sendPort.send('Context size exceeded');
-        break;
+    for (var i = 0; i < count; i++) {
+      final input = _scratch.string(command.inputs[i]);
+      lib.llama_tokenize(vocab, input.text, input.length, tokens + offset, lengths[i], true, true);
+      offset += lengths[i];
+    }
+
+    // Ownership of the matrix passes to the calling isolate
+    final matrix = malloc<ffi.Float>(count * dimensions);
+
+    final status = native.lcpp_embed(context, tokens, lengths, count, command.normalize, matrix);
+
+    calloc.free(lengths);
+
+    final error = _statusMessage(status);
+    if (error != null) {
+      malloc.free(matrix);
+      command.sendPort.send(error);
+      return;
+    }
+
+    command.sendPort.send((
+      address: matrix.address,
+      count: count,
+      dimensions: dimensions
+    ));
+  }
+
+  static void _score(ScoreCommand command) {
+    if (_server != null) {
+      command.sendPort.send('Scoring is not supported when prompts are batched together');
+      return;
+    }
+
+    final vocab = lib.llama_model_get_vocab(_model!);
+    final count = command.candidates.length;
+
+    final lengths = calloc<ffi.Int32>(count);
+    ffi.Pointer<ffi.Float> logprobs = ffi.nullptr;
+
+    try {
+      _applyLoras(_loras);
+      final prompt = _chat.tokenize(_model!, command.messages);
+      final nReused = _reuseCache(prompt.tokens, prompt.count);
+
+      // Candidates continue the rendered prompt, so no special tokens are added or parsed
+      int total = 0;
+      for (var i = 0; i < count; i++) {
+        final candidate = _scratch.string(command.candidates[i]);
+        lengths[i] = -lib.llama_tokenize(vocab, candidate.text, candidate.length, ffi.nullptr, 0, false, false);
+        total += lengths[i];
       }
 
-      if (lib.llama_decode(_context!, batch) != 0) {
-        _sendPort.send('Failed to decode');
-        break;
+      final tokens = _scratch.tokens(total);
+      int offset = 0;
+
+      for (var i = 0; i < count; i++) {
+        final candidate = _scratch.string(command.candidates[i]);
+        lib.llama_tokenize(vocab, candidate.text, candidate.length, tokens + offset, lengths[i], false, false);
+        offset += lengths[i];
       }
 
-      newTokenId = lib.llama_sampler_sample(_sampler!, _context!, -1);
+      logprobs = calloc<ffi.Float>(max(total, 1));
 
-      // is it an end of generation?
-      if (lib.llama_vocab_is_eog(vocab, newTokenId)) {
-        break;
+      final params = _generationParams.toNative();
+      params.history = _cache;
+      params.n_history = _nCache;
+
+      // The prompt is decoded once and every candidate is evaluated on a copy of its KV cache
+      final status = native.lcpp_score(
+        _context!,
+        prompt.tokens + nReused,
+        prompt.count - nReused,
+        tokens,
+        lengths,
+        count,
+        logprobs,
+        params
+      );
+
+      final error = _statusMessage(status);
+      if (error != null) {
+        throw Exception(error);
       }
 
-      final buffer = calloc<ffi.Char>(256);
-      final n = lib.llama_token_to_piece(vocab, newTokenId, buffer, 256, 0, true);
-      if (n < 0) {
-        _sendPort.send('Failed to convert token to piece');
-        break;
+      final scores = <CandidateScore>[];
+      offset = 0;
+
+      for (var i = 0; i < count; i++) {
+        final values = List<double>.generate(lengths[i], (j) => logprobs[offset + j]);
+        scores.add((logprobs: values, total: values.fold(0.0, (sum, value) => sum + value)));
+        offset += lengths[i];
       }
 
-      final piece = buffer.cast<Utf8>().toDartString();
-      finalOutput += piece;
+      command.sendPort.send(scores);
+    } catch (e) {
+      command.sendPort.send(e.toString());
+    } finally {
+      calloc.free(lengths);
 
-      _sendPort.send((message: piece, done: false));
+      if (logprobs != ffi.nullptr) {
+        calloc.free(logprobs);
+      }
+    }
+  }
 
-      final newTokenPointer = calloc<llama_token>(1);
-      newTokenPointer.value = newTokenId;
+  static void _setLoras(LoraCommand command) {
+    if (_server != null) {
+      command.sendPort.send('LoRA adapters cannot change when prompts are batched together');
+      return;
+    }
 
-      batch = lib.llama_batch_get_one(newTokenPointer, 1);
+    try {
+      _applyLoras(command.loras);
+      _loras = command.loras;
+      command.sendPort.send(null);
+    } catch (e) {
+      command.sendPort.send(e.toString());
     }
+  }
+
+  static void _session(SessionCommand command) {
+    if (_server != null) {
+      command.sendPort.send('Sessions are not supported when prompts are batched together');
+      return;
+    }
+
+    final path = command.path.toNativeUtf8();
+
+    final status = command.save
+      ? native.lcpp_session_save(_context!, path.cast<ffi.Char>(), _cache, _nCache.value)
+      : native.lcpp_session_load(_context!, path.cast<ffi.Char>(), _cache, lib.llama_n_ctx(_context!), _nCache);
 
-    return finalOutput;
+    malloc.free(path);
+
+    command.sendPort.send(_statusMessage(status));
+  }
+
+  static void _submit(PromptCommand command) {
+    try {
+      final prompt = _format(command.messages);
+      final tokens = _tokenize(prompt.text, prompt.length);
+
+      if (command.topLogprobs != null) {
+        command.sendPort.send('Log probabilities are not reported when prompts are batched together');
+      }
+
+      if (command.loras != null) {
+        throw Exception('LoRA adapters cannot change per prompt when prompts are batched together');
+      }
+
+      // The server decodes this request alongside the others in its own sequence, with a clone of the chain
+      final id = native.lcpp_server_submit(_server!, _samplerFor(command.samplingParams), tokens.tokens, tokens.count);
+
+      if (id < 0) {
+        throw Exception('Nothing to decode');
+      }
+
+      _requests[id] = (sendPort: command.sendPort, output: StringBuffer());
+    } catch (e) {
+      command.sendPort.send(e.toString());
+      command.sendPort.send((message: '', done: true));
+    }
+  }
+
+  static void _onServerText(int id, ffi.Pointer<ffi.Void> userData) {
+    final request = _requests[id];
+    if (request == null) {
+      return;
+    }
+
+    while (true) {
+      final length = native.lcpp_server_read(_server!, id, _readBuffer, _readBufferSize, _readDone, _readStatus);
+
+      if (length > 0) {
+        final piece = _readBuffer.cast<Utf8>().toDartString(length: length);
+        request.output.write(piece);
+        request.sendPort.send((message: piece, done: false));
+      }
+
+      if (_readDone.value) {
+        _requests.remove(id);
+        _sendStatus(request.sendPort, _readStatus.value);
+        request.sendPort.send((message: request.output.toString(), done: true));
+        return;
+      }
+
+      if (length == 0) {
+        return;
+      }
+    }
+  }
+
+  static bool _onPrefill(int decoded, int total, double milliseconds, ffi.Pointer<ffi.Void> userData) {
+    _sendPort.send((
+      decoded: decoded,
+      total: total,
+      percent: decoded * 100 / total,
+      tokensPerSecond: milliseconds > 0 ? decoded * 1000 / milliseconds : 0.0
+    ));
+
+    return !_stop.value;
+  }
+
+  static void _onProbs(int token, double logprob, ffi.Pointer<llama_token> topTokens, ffi.Pointer<ffi.Float> topLogprobs, int count, ffi.Pointer<ffi.Void> userData) {
+    _sendPort.send((
+      token: token,
+      logprob: logprob,
+      topTokens: List<int>.generate(count, (i) => topTokens[i]),
+      topLogprobs: List<double>.generate(count, (i) => topLogprobs[i])
+    ));
+  }
+
+  static bool _onText(ffi.Pointer<ffi.Char> text, int length, ffi.Pointer<ffi.Void> userData) {
+    final piece = text.cast<Utf8>().toDartString(length: length);
+    _output.write(piece);
+
+    _sendPort.send((message: piece, done: false));
+
+    return !_stop.value;
   }
 
   Future<void> stop() async {
-    _sendPort.send(true);
-    await _completer!.future;
-    return;
+    // The inference isolate is busy in native code and checks this flag between tokens
+    _stopFlag?.value = true;
+    _stops++;
+
+    // The server runs on its own thread, so its requests are cancelled through the isolate
+    if (_concurrent) {
+      final commandPort = await _commandPort.future;
+      commandPort.send(IsolateCommand.stop);
+    }
+
+    await Future.wait(_prompts.map((prompt) => prompt.future));
+  }
+
+  /// Embeds [input] into a vector of the model's embedding size.
+  Future<Float32List> embed(String input, {bool normalize = true}) async {
+    return (await embedAll([input], normalize: normalize)).first;
+  }
+
+  /// Embeds every input, decoding as many as fit in [ContextParams.nBatch]
+  /// tokens together, up to [ContextParams.nSeqMax] or at least 8 inputs.
+  ///
+  /// The vectors are views of a single native matrix that is freed once none
+  /// of them is reachable. The pooling comes from [ContextParams.poolingType],
+  /// and every input has to fit in one batch, which is decoded as a single
+  /// ubatch of [ContextParams.nBatch] tokens. Inputs are decoded in a context
+  /// of their own, created on first use with room for one batch, so the
+  /// conversation's KV cache is kept and batched prompts are supported.
+  Future<List<Float32List>> embedAll(List<String> inputs, {bool normalize = true}) async {
+    if (inputs.isEmpty) {
+      return [];
+    }
+
+    final commandPort = await _commandPort.future;
+    await Future.wait(_prompts.map((prompt) => prompt.future));
+
+    final receivePort = ReceivePort();
+
+    commandPort.send((
+      inputs: inputs,
+      normalize: normalize,
+      sendPort: receivePort.sendPort
+    ));
+
+    final response = await receivePort.first;
+    if (response is! EmbedResponse) {
+      throw Exception(response);
+    }
+
+    final matrix = ffi.Pointer<ffi.Float>.fromAddress(response.address)
+      .asTypedList(response.count * response.dimensions, finalizer: malloc.nativeFree);
+
+    return List.generate(
+      response.count, 
+      (i) => Float32List.sublistView(matrix, i * response.dimensions, (i + 1) * response.dimensions)
+    );
+  }
+
+  /// Log-probabilities of every candidate as the reply to [messages].
+  ///
+  /// The conversation is decoded once, reusing the KV cache like [prompt],
+  /// and the candidates are evaluated on copies of it, up to 7 of them packed
+  /// into each decode, so every candidate only costs its own tokens. The
+  /// conversation stays in the KV cache, the candidates do not. Not supported
+  /// when prompts are batched together.
+  Future<List<CandidateScore>> score(List<ChatMessage> messages, List<String> candidates) async {
+    if (candidates.isEmpty) {
+      return [];
+    }
+
+    final commandPort = await _commandPort.future;
+    await Future.wait(_prompts.map((prompt) => prompt.future));
+
+    final receivePort = ReceivePort();
+
+    commandPort.send((
+      messages: messages,
+      candidates: candidates,
+      sendPort: receivePort.sendPort
+    ));
+
+    final response = await receivePort.first;
+    if (response is! List<CandidateScore>) {
+      throw Exception(response);
+    }
+
+    return response;
+  }
+
+  /// Saves the conversation held in the KV cache to [path] once the pending
+  /// prompts have finished, so [loadSession] can resume it without a prefill.
+  Future<void> saveSession(String path) => _sendSession(path, true);
+
+  /// Restores a conversation saved with [saveSession] by the same model.
+  ///
+  /// The next prompt only decodes what follows the restored tokens.
+  Future<void> loadSession(String path) => _sendSession(path, false);
+
+  Future<void> _sendSession(String path, bool save) async {
+    final commandPort = await _commandPort.future;
+    await Future.wait(_prompts.map((prompt) => prompt.future));
+
+    final receivePort = ReceivePort();
+
+    commandPort.send((
+      path: path,
+      save: save,
+      sendPort: receivePort.sendPort
+    ));
+
+    final error = await receivePort.first;
+    if (error is String) {
+      throw Exception(error);
+    }
+  }
+
+  /// Replaces the LoRA adapters of [ModelParams.loras] for the following
+  /// prompts, once the pending ones have finished. Adapters are loaded on
+  /// first use and kept, so switching between them does not reload anything,
+  /// an empty map runs the base model alone. Not supported when prompts are
+  /// batched together.
+  Future<void> setLoras(Map<String, double> loras) async {
+    final commandPort = await _commandPort.future;
+    await Future.wait(_prompts.map((prompt) => prompt.future));
+
+    final receivePort = ReceivePort();
+
+    commandPort.send((
+      loras: Map<String, double>.of(loras),
+      sendPort: receivePort.sendPort
+    ));
+
+    final error = await receivePort.first;
+    if (error is String) {
+      throw Exception(error);
+    }
+  }
+
+  Future<void> clear() async {
+    final commandPort = await _commandPort.future;
+    commandPort.send(IsolateCommand.clear);
+  }
+
+  Future<void> dispose() async {
+    final commandPort = await _commandPort.future;
+    await stop();
+    _stopFlag = null;
+    commandPort.send(IsolateCommand.dispose);
+
+    // Every prompt has finished, so the inference isolate no longer writes to the stream
+    if (_stream != null) {
+      native.lcpp_stream_free(_stream!);
+      _streamCallback!.close();
+      calloc.free(_peekText!);
+      calloc.free(_peekTokens!);
+      _stream = null;
+    }
+  }
+}
+
+/// Decodes the text of a ring buffer into the stream of a prompt,
+/// multi-byte sequences may be split between two reads.
+class _StreamReader {
+  final StreamController<String> controller;
+  final void Function(Int32List)? onTokens;
+  final StringBuffer _decoded = StringBuffer();
+  late final ByteConversionSink _decoder;
+
+  _StreamReader(this.controller, this.onTokens) {
+    _decoder = const Utf8Decoder(allowMalformed: true)
+      .startChunkedConversion(StringConversionSink.fromStringSink(_decoded));
+  }
+
+  void addText(Uint8List bytes) {
+    _decoder.addSlice(bytes, 0, bytes.length, false);
+  }
+
+  void flush() {
+    if (_decoded.isNotEmpty) {
+      controller.add(_decoded.toString());
+      _decoded.clear();
+    }
   }
 
-  void clear() {
-    _contextLength = 0;
+  void close() {
+    _decoder.close();
+    flush();
   }
 }
@@ -0,0 +1,228 @@
+part of '../lcpp.dart';
+
+typedef MemoryEstimate = ({
+  int weightBytes,
+  int kvCacheBytes,
+  int computeBytes,
+  int totalBytes
+});
+
+typedef MemoryPlan = ({
+  int nCtx,
+  GgmlType typeK,
+  GgmlType typeV,
+  int nBatch,
+  MemoryEstimate estimate
+});
+
+/// Shape of a GGUF model, read from its metadata without loading the weights.
+class ModelInfo {
+  final int layers;
+  final int embeddingLength;
+  final int feedForwardLength;
+  final int heads;
+  final int headsKv;
+  final int keyLength;
+  final int valueLength;
+  final int trainContextLength;
+  final int vocabSize;
+  final int weightBytes;
+
+  ModelInfo({
+    required this.layers,
+    required this.embeddingLength,
+    required this.feedForwardLength,
+    required this.heads,
+    required this.headsKv,
+    required this.keyLength,
+    required this.valueLength,
+    required this.trainContextLength,
+    required this.vocabSize,
+    required this.weightBytes,
+  });
+
+  ModelInfo._(lcpp_model_info info)
+      : layers = info.n_layer,
+        embeddingLength = info.n_embd,
+        feedForwardLength = info.n_ff,
+        heads = info.n_head,
+        headsKv = info.n_head_kv,
+        keyLength = info.n_embd_head_k,
+        valueLength = info.n_embd_head_v,
+        trainContextLength = info.n_ctx_train,
+        vocabSize = info.n_vocab,
+        weightBytes = info.n_bytes;
+
+  factory ModelInfo.read(String modelPath) {
+    final path = modelPath.toNativeUtf8();
+    final info = calloc<lcpp_model_info>();
+
+    try {
+      if (LlamaCPP.native.lcpp_model_read_info(path.cast<ffi.Char>(), info) != lcpp_status.LCPP_STATUS_OK) {
+        throw Exception('Failed to read model metadata');
+      }
+
+      return ModelInfo._(info.ref);
+    } finally {
+      malloc.free(path);
+      calloc.free(info);
+    }
+  }
+}
+
+/// Estimates what a context costs before it is created, and picks the largest one fitting a memory budget.
+///
+/// Estimates follow how llama.cpp sizes its buffers: the weights, a KV cache of nCtx cells for every
+/// layer, and a compute buffer for one micro-batch with its logits, feed forward activations and,
+/// without flash attention, attention scores. They are meant to leave headroom, not to be exact.
+class MemoryPlanner {
+  // KV cache types tried by plan, most precise first
+  static const _kvTypes = [GgmlType.f16, GgmlType.q8_0, GgmlType.q4_0];
+
+  final ModelInfo model;
+
+  MemoryPlanner(this.model);
+
+  MemoryPlanner.fromFile(String modelPath) : model = ModelInfo.read(modelPath);
+
+  MemoryEstimate estimate({
+    required int nCtx,
+    GgmlType typeK = GgmlType.f16,
+    GgmlType typeV = GgmlType.f16,
+    int nBatch = 2048,
+    int nUBatch = 512,
+    int nSeqMax = 1,
+    bool flashAttention = false,
+    bool weightsLoaded = false
+  }) {
+    // llama.cpp pads the context to a multiple of 256 cells
+    final cells = (nCtx + 255) ~/ 256 * 256;
+    final ubatch = min(nUBatch, nBatch);
+
+    final kvCacheBytes = (
+      model.layers * cells * model.headsKv * (model.keyLength * _typeSize(typeK) + model.valueLength * _typeSize(typeV))
+    ).ceil();
+
+    final scores = flashAttention ? 0 : ubatch * cells * model.heads;
+    final activations = ubatch * (model.vocabSize + 2 * model.feedForwardLength + 4 * model.embeddingLength);
+    final outputs = nSeqMax * model.vocabSize;
+
+    final computeBytes = 4 * (scores + activations + outputs);
+
+    // Weights already held by another instance are shared, not loaded again
+    final weightBytes = weightsLoaded ? 0 : model.weightBytes;
+
+    return (
+      weightBytes: weightBytes,
+      kvCacheBytes: kvCacheBytes,
+      computeBytes: computeBytes,
+      totalBytes: weightBytes + kvCacheBytes + computeBytes
+    );
+  }
+
+  /// The largest context fitting [budgetBytes], with the most precise KV cache types that reach it.
+  ///
+  /// Fields already set in [constraints] (nCtx, typeK, typeV, nBatch, nUBatch, nSeqMax and
+  /// flashAttention) are kept as they are. [weightsLoaded] leaves out weights already resident
+  /// in the model registry. Returns null if not even 256 tokens, or the model's whole training
+  /// context when it is shorter, fit.
+  MemoryPlan? plan(int budgetBytes, [ContextParams? constraints, bool weightsLoaded = false]) {
+    final flashAttention = constraints?.flashAttention ?? false;
+    final nUBatch = constraints?.nUBatch ?? 512;
+    final nSeqMax = constraints?.nSeqMax ?? 1;
+
+    // A quantized V cache needs flash attention
+    final typesK = constraints?.typeK != null ? [constraints!.typeK!] : _kvTypes;
+    final typesV = constraints?.typeV != null ? [constraints!.typeV!] : flashAttention ? _kvTypes : [GgmlType.f16];
+
+    final combinations = [
+      for (final typeK in typesK)
+        for (final typeV in typesV)
+          (typeK: typeK, typeV: typeV)
+    ]..sort((a, b) => (_typeSize(b.typeK) + _typeSize(b.typeV)).compareTo(_typeSize(a.typeK) + _typeSize(a.typeV)));
+
+    final fixedCtx = constraints?.nCtx != null && constraints!.nCtx! > 0 ? constraints.nCtx : null;
+    final maxCtx = fixedCtx ?? (model.trainContextLength > 0 ? model.trainContextLength : 4096);
+
+    MemoryEstimate estimateFor(int nCtx, GgmlType typeK, GgmlType typeV) => estimate(
+      nCtx: nCtx,
+      typeK: typeK,
+      typeV: typeV,
+      nBatch: constraints?.nBatch ?? min(2048, nCtx),
+      nUBatch: nUBatch,
+      nSeqMax: nSeqMax,
+      flashAttention: flashAttention,
+      weightsLoaded: weightsLoaded
+    );
+
+    MemoryPlan? best;
+
+    for (final types in combinations) {
+      int nCtx = 0;
+
+      // A fixed or short context is either taken whole or not at all
+      if (fixedCtx != null || maxCtx < 256) {
+        nCtx = estimateFor(maxCtx, types.typeK, types.typeV).totalBytes <= budgetBytes ? maxCtx : 0;
+      }
+      else {
+        // Largest multiple of 256 that fits, the estimate grows with the context
+        int low = 0;
+        int high = maxCtx ~/ 256;
+
+        while (low < high) {
+          final mid = (low + high + 1) ~/ 2;
+
+          if (estimateFor(mid * 256, types.typeK, types.typeV).totalBytes <= budgetBytes) {
+            low = mid;
+          }
+          else {
+            high = mid - 1;
+          }
+        }
+
+        nCtx = low * 256;
+      }
+
+      if (nCtx > 0 && (best == null || nCtx > best.nCtx)) {
+        best = (
+          nCtx: nCtx,
+          typeK: types.typeK,
+          typeV: types.typeV,
+          nBatch: constraints?.nBatch ?? min(2048, nCtx),
+          estimate: estimateFor(nCtx, types.typeK, types.typeV)
+        );
+      }
+
+      // Less precise types could not give a larger context
+      if (best != null && best.nCtx >= maxCtx ~/ 256 * 256) {
+        break;
+      }
+    }
+
+    return best;
+  }
+
+  // Bytes per element, quantized types store blocks of 32 elements
+  static double _typeSize(GgmlType type) {
+    switch (type) {
+      case GgmlType.f32:
+        return 4;
+      case GgmlType.f16:
+      case GgmlType.bf16:
+        return 2;
+      case GgmlType.q8_0:
+        return 34 / 32;
+      case GgmlType.q5_1:
+        return 24 / 32;
+      case GgmlType.q5_0:
+        return 22 / 32;
+      case GgmlType.q4_1:
+        return 20 / 32;
+      case GgmlType.q4_0:
+      case GgmlType.iq4_nl:
+        return 18 / 32;
+      default:
+        return 2;
+    }
+  }
+}
@@ -1,5 +1,6 @@
 part of '../lcpp.dart';
 
+/// Receives the model load progress from 0 to 1, returning false cancels the load.
 typedef OnProgressCallback = bool Function(double progress);
 
 class ModelParams {
@@ -8,11 +9,25 @@ class ModelParams {
   bool? useMlock;
   bool? checkTensors;
 
+  // how threads are spread across NUMA nodes, applied once per process before the first model loads
+  NumaStrategy? numa;
+
+  // read the weights through the page cache on a background thread while and after loading,
+  // so the first decodes do not stall on page faults. Only used with mmap
+  bool? prefetch;
+
+  // LoRA adapter paths and the scale they are applied at, loaded once per process for the model
+  // and shared by every instance using both
+  Map<String, double>? loras;
+
   ModelParams({
     this.vocabOnly,
     this.useMmap,
     this.useMlock,
     this.checkTensors,
+    this.numa,
+    this.prefetch,
+    this.loras,
   });
 
   llama_model_params toNative() {
@@ -36,4 +51,12 @@ class ModelParams {
 
     return modelParams;
   }
-}
\ No newline at end of file
+}
+
+enum NumaStrategy {
+  disabled,
+  distribute,
+  isolate,
+  numactl,
+  mirror;
+}
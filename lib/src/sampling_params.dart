@@ -37,6 +37,11 @@ typedef GrammarArgs = ({
   String root
 });
 
+// schema is JSON text, jsonEncode a Map first
+typedef JsonSchemaArgs = ({
+  String schema
+});
+
 typedef PenaltiesArgs = ({
   int lastN, 
   double repeat, 
@@ -66,6 +71,7 @@ class SamplingParams {
   MirostatArgs? mirostat;
   MirostatV2Args? mirostatV2;
   GrammarArgs? grammar;
+  JsonSchemaArgs? jsonSchema;
   PenaltiesArgs? penalties;
   DrySamplerArgs? drySampler;
 
@@ -82,13 +88,73 @@ class SamplingParams {
     this.mirostat,
     this.mirostatV2,
     this.grammar,
+    this.jsonSchema,
     this.penalties,
     this.drySampler
   });
 
+  // Params with equal values build equal chains, the inference isolate pools chains by them
+  @override
+  bool operator ==(Object other) {
+    return other is SamplingParams &&
+      other.greedy == greedy &&
+      other.infill == infill &&
+      other.seed == seed &&
+      other.topK == topK &&
+      other.topP == topP &&
+      other.minP == minP &&
+      other.typicalP == typicalP &&
+      other.temperature == temperature &&
+      other.xtc == xtc &&
+      other.mirostat == mirostat &&
+      other.mirostatV2 == mirostatV2 &&
+      other.grammar == grammar &&
+      other.jsonSchema == jsonSchema &&
+      other.penalties == penalties &&
+      _drySamplerKey(other.drySampler) == _drySamplerKey(drySampler);
+  }
+
+  @override
+  int get hashCode => Object.hash(
+    greedy,
+    infill,
+    seed,
+    topK,
+    topP,
+    minP,
+    typicalP,
+    temperature,
+    xtc,
+    mirostat,
+    mirostatV2,
+    grammar,
+    jsonSchema,
+    penalties,
+    _drySamplerKey(drySampler)
+  );
+
+  // Records compare lists by identity, the sequence breakers are compared by value instead
+  static Record? _drySamplerKey(DrySamplerArgs? args) {
+    if (args == null) {
+      return null;
+    }
+
+    return (
+      args.nCtxTrain,
+      args.multiplier,
+      args.dryBase,
+      args.allowedLength,
+      args.penaltyLastN,
+      args.sequenceBreakers.join('\u0000')
+    );
+  }
+
   ffi.Pointer<llama_sampler> toNative(ffi.Pointer<llama_vocab> vocab) {
     final sampler = LlamaCPP.lib.llama_sampler_chain_init(LlamaCPP.lib.llama_sampler_chain_default_params());
 
+    // The samplers copy what they need, strings are released once the chain is built
+    final arena = Arena();
+
     if (greedy) {
       LlamaCPP.lib.llama_sampler_chain_add(sampler, LlamaCPP.lib.llama_sampler_init_greedy());
     }
@@ -153,13 +219,37 @@ class SamplingParams {
       );
     }
 
+    // Grammars are parsed once per process and cloned from the native cache afterwards
+    final error = grammar != null || jsonSchema != null ? arena<ffi.Char>(_errorSize) : ffi.nullptr.cast<ffi.Char>();
+
     if (grammar != null) {
-      LlamaCPP.lib.llama_sampler_chain_add(
+      _addGrammar(
         sampler, 
-        LlamaCPP.lib.llama_sampler_init_grammar(
+        arena,
+        error,
+        LlamaCPP.native.lcpp_grammar_init(
           vocab, 
-          grammar!.str.toNativeUtf8().cast<ffi.Char>(), 
-          grammar!.root.toNativeUtf8().cast<ffi.Char>()
+          grammar!.str.toNativeUtf8(allocator: arena).cast<ffi.Char>(), 
+          grammar!.root.toNativeUtf8(allocator: arena).cast<ffi.Char>(),
+          false,
+          error,
+          _errorSize
+        )
+      );
+    }
+
+    if (jsonSchema != null) {
+      _addGrammar(
+        sampler, 
+        arena,
+        error,
+        LlamaCPP.native.lcpp_grammar_init(
+          vocab, 
+          jsonSchema!.schema.toNativeUtf8(allocator: arena).cast<ffi.Char>(), 
+          ffi.nullptr,
+          true,
+          error,
+          _errorSize
         )
       );
     }
@@ -177,9 +267,9 @@ class SamplingParams {
     }
 
     if (drySampler != null) {
-      final sequenceBreakers = calloc<ffi.Pointer<ffi.Char>>(drySampler!.sequenceBreakers.length);
+      final sequenceBreakers = arena<ffi.Pointer<ffi.Char>>(drySampler!.sequenceBreakers.length);
       for (var i = 0; i < drySampler!.sequenceBreakers.length; i++) {
-        sequenceBreakers[i] = drySampler!.sequenceBreakers[i].toNativeUtf8().cast<ffi.Char>();
+        sequenceBreakers[i] = drySampler!.sequenceBreakers[i].toNativeUtf8(allocator: arena).cast<ffi.Char>();
       }
 
       LlamaCPP.lib.llama_sampler_chain_add(
@@ -197,6 +287,23 @@ class SamplingParams {
       );
     }
 
+    arena.releaseAll();
+
     return sampler;
   }
+
+  // Room for the reason lcpp_grammar_init gives when a grammar or schema is invalid
+  static const _errorSize = 512;
+
+  static void _addGrammar(ffi.Pointer<llama_sampler> sampler, Arena arena, ffi.Pointer<ffi.Char> error, ffi.Pointer<llama_sampler> grammar) {
+    if (grammar == ffi.nullptr) {
+      final message = error.cast<Utf8>().toDartString();
+
+      arena.releaseAll();
+      LlamaCPP.lib.llama_sampler_free(sampler);
+      throw Exception(message.isNotEmpty ? message : 'Failed to parse grammar');
+    }
+
+    LlamaCPP.lib.llama_sampler_chain_add(sampler, grammar);
+  }
 }
\ No newline at end of file
@@ -0,0 +1,137 @@
+part of '../lcpp.dart';
+
+/// Native buffers owned by an inference isolate and reused across prompts.
+///
+/// Buffers only ever grow, and their contents are not kept when they do, so
+/// once a session has seen its largest prompt it stops allocating native
+/// memory. [allocations] counts every allocation the pool has made and
+/// [bytes] the native memory it currently holds.
+///
+/// Memory kept across prompts by others, like the [ChatCache] copies of the
+/// conversation, is allocated through the pool as an [ffi.Allocator] so that
+/// it is counted too, until it is freed.
+class ScratchPool implements ffi.Allocator {
+  final _ScratchBuffer _text = _ScratchBuffer();
+  final _ScratchBuffer _tokens = _ScratchBuffer();
+  final _ScratchBuffer _messages = _ScratchBuffer();
+  final _ScratchBuffer _strings = _ScratchBuffer();
+
+  // Sizes of the allocations made as an allocator, by address
+  final Map<int, int> _allocated = {};
+  int _allocatedBytes = 0;
+
+  int _allocations = 0;
+
+  int get allocations => _allocations;
+
+  int get bytes => _text.capacity + _tokens.capacity + _messages.capacity + _strings.capacity + _allocatedBytes;
+
+  /// A buffer for at least [length] characters.
+  ffi.Pointer<ffi.Char> text(int length) {
+    return _reserve(_text, length).cast<ffi.Char>();
+  }
+
+  /// A buffer for at least [count] tokens.
+  ffi.Pointer<llama_token> tokens(int count) {
+    return _reserve(_tokens, count * ffi.sizeOf<llama_token>()).cast<llama_token>();
+  }
+
+  /// Copies [string] into native memory as UTF-8, valid until the next call.
+  ({ffi.Pointer<ffi.Char> text, int length}) string(String string) {
+    final encoded = utf8.encode(string);
+    final native = _reserve(_strings, encoded.length + 1);
+
+    native.asTypedList(encoded.length + 1)
+      ..setAll(0, encoded)
+      ..[encoded.length] = 0;
+
+    return (text: native.cast<ffi.Char>(), length: encoded.length);
+  }
+
+  /// Copies [messages] into native memory, valid until the next call.
+  ffi.Pointer<llama_chat_message> messages(List<ChatMessage> messages) {
+    final encoded = <Uint8List>[];
+    int size = 0;
+
+    for (final message in messages) {
+      encoded
+        ..add(utf8.encode(message.role))
+        ..add(utf8.encode(message.content));
+
+      size += encoded[encoded.length - 2].length + encoded.last.length + 2;
+    }
+
+    final strings = _reserve(_strings, size);
+    final native = _reserve(_messages, messages.length * ffi.sizeOf<llama_chat_message>()).cast<llama_chat_message>();
+
+    final view = strings.asTypedList(size);
+    int offset = 0;
+
+    for (var i = 0; i < encoded.length; i++) {
+      final string = strings + offset;
+
+      view.setAll(offset, encoded[i]);
+      offset += encoded[i].length;
+      view[offset++] = 0;
+
+      if (i.isEven) {
+        native[i ~/ 2].role = string.cast<ffi.Char>();
+      }
+      else {
+        native[i ~/ 2].content = string.cast<ffi.Char>();
+      }
+    }
+
+    return native;
+  }
+
+  /// Zero-initialized memory that is kept until passed to [free].
+  @override
+  ffi.Pointer<T> allocate<T extends ffi.NativeType>(int byteCount, {int? alignment}) {
+    final pointer = calloc.allocate<T>(byteCount, alignment: alignment);
+
+    _allocated[pointer.address] = byteCount;
+    _allocatedBytes += byteCount;
+    _allocations++;
+
+    return pointer;
+  }
+
+  @override
+  void free(ffi.Pointer<ffi.NativeType> pointer) {
+    _allocatedBytes -= _allocated.remove(pointer.address) ?? 0;
+    calloc.free(pointer);
+  }
+
+  void dispose() {
+    for (final buffer in [_text, _tokens, _messages, _strings]) {
+      if (buffer.pointer != ffi.nullptr) {
+        calloc.free(buffer.pointer);
+      }
+
+      buffer.pointer = ffi.nullptr;
+      buffer.capacity = 0;
+    }
+  }
+
+  ffi.Pointer<ffi.Uint8> _reserve(_ScratchBuffer buffer, int size) {
+    if (size <= buffer.capacity) {
+      return buffer.pointer;
+    }
+
+    if (buffer.pointer != ffi.nullptr) {
+      calloc.free(buffer.pointer);
+    }
+
+    buffer.capacity = max(size, buffer.capacity * 2);
+    buffer.pointer = calloc<ffi.Uint8>(buffer.capacity);
+    _allocations++;
+
+    return buffer.pointer;
+  }
+}
+
+class _ScratchBuffer {
+  ffi.Pointer<ffi.Uint8> pointer = ffi.nullptr;
+  int capacity = 0;
+}
@@ -0,0 +1,50 @@
+part of '../lcpp.dart';
+
+class ThreadpoolParams {
+  // number of threads in the pool
+  int nThreads;
+
+  // indices of the CPUs the threads may run on, null = any CPU
+  List<int>? cpus;
+
+  // scheduling priority of the threads
+  ThreadPriority? priority;
+
+  // polling level between graphs, 0 = no polling and 100 = aggressive polling
+  int? poll;
+
+  // pin each thread to a single CPU of [cpus] instead of letting it float across all of them
+  bool? strictCpu;
+
+  ThreadpoolParams(this.nThreads, {
+    this.cpus,
+    this.priority,
+    this.poll,
+    this.strictCpu,
+  });
+
+  /// Allocated with calloc, the caller frees it.
+  ffi.Pointer<ggml_threadpool_params> toNative() {
+    final threadpoolParams = calloc<ggml_threadpool_params>();
+
+    // same defaults as ggml_threadpool_params_init, which lives in ggml-base rather than llama
+    threadpoolParams.ref.n_threads = nThreads;
+    threadpoolParams.ref.prio = (priority ?? ThreadPriority.normal).index;
+    threadpoolParams.ref.poll = poll ?? 50;
+    threadpoolParams.ref.strict_cpu = strictCpu ?? false;
+    threadpoolParams.ref.paused = false;
+
+    for (final cpu in cpus ?? const <int>[]) {
+      threadpoolParams.ref.cpumask[cpu] = true;
+    }
+
+    return threadpoolParams;
+  }
+}
+
+enum ThreadPriority {
+  normal,
+  medium,
+  high,
+  realtime;
+}
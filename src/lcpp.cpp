@@ -0,0 +1,2278 @@
+#include "lcpp.h"
+#include "gguf.h"
+#include "json-schema-to-grammar.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <fstream>
+#else
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Returns the length of the longest prefix of `text` that does not end inside a multi-byte UTF-8 sequence
+static size_t utf8_complete_length(const std::string & text) {
+    const size_t n = text.size();
+
+    // a sequence is at most 4 bytes long, so only the last 3 bytes can belong to an incomplete one
+    for (size_t i = 1; i <= 3 && i <= n; ++i) {
+        const unsigned char c = text[n - i];
+
+        if ((c & 0xC0) == 0x80) {
+            continue; // continuation byte
+        }
+
+        size_t expected = 1;
+        if      ((c & 0xE0) == 0xC0) expected = 2;
+        else if ((c & 0xF0) == 0xE0) expected = 3;
+        else if ((c & 0xF8) == 0xF0) expected = 4;
+
+        return expected > i ? n - i : n;
+    }
+
+    return n;
+}
+
+static void batch_add(llama_batch & batch, llama_token token, llama_pos pos, llama_seq_id seq_id, bool logits) {
+    batch.token   [batch.n_tokens]    = token;
+    batch.pos     [batch.n_tokens]    = pos;
+    batch.n_seq_id[batch.n_tokens]    = 1;
+    batch.seq_id  [batch.n_tokens][0] = seq_id;
+    batch.logits  [batch.n_tokens]    = logits;
+
+    batch.n_tokens++;
+}
+
+// Ring buffer with one writer and one reader, head and tail count every element ever written and read
+template <typename T>
+struct lcpp_ring {
+    std::vector<T> data;
+
+    std::atomic<size_t> head { 0 };
+    std::atomic<size_t> tail { 0 };
+
+    explicit lcpp_ring(size_t size) : data(size) {}
+
+    // Copies as many of the n elements as fit and returns how many were written
+    size_t write(const T * src, size_t n) {
+        const size_t size = data.size();
+        const size_t h    = head.load(std::memory_order_relaxed);
+
+        n = std::min(n, size - (h - tail.load(std::memory_order_acquire)));
+
+        const size_t i     = h % size;
+        const size_t first = std::min(n, size - i);
+
+        std::copy(src, src + first, data.data() + i);
+        std::copy(src + first, src + n, data.data());
+
+        head.store(h + n, std::memory_order_release);
+
+        return n;
+    }
+
+    size_t peek(const T ** dst) const {
+        const size_t size = data.size();
+        const size_t t    = tail.load(std::memory_order_relaxed);
+        const size_t i    = t % size;
+
+        *dst = data.data() + i;
+
+        return std::min(head.load(std::memory_order_acquire) - t, size - i);
+    }
+
+    void consume(size_t n) {
+        tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+};
+
+//
+// Model registry
+//
+
+using lcpp_model_key = std::tuple<std::string, bool, bool, bool>;
+
+struct lcpp_model_entry {
+    llama_model * model;
+    int32_t       n_refs;
+};
+
+static std::mutex                                 g_registry_mutex;
+static std::map<lcpp_model_key, lcpp_model_entry> g_registry;
+static lcpp_model_registry_stats                  g_registry_stats = {};
+
+using lcpp_adapter_key = std::pair<const llama_model *, std::string>;
+
+struct lcpp_adapter_entry {
+    llama_adapter_lora * adapter;
+    int32_t              n_refs;
+};
+
+// guarded by g_registry_mutex, like the models the adapters belong to
+static std::map<lcpp_adapter_key, lcpp_adapter_entry> g_adapters;
+
+// Directory of the file this library was loaded from, empty if it cannot be found
+static std::string library_dir() {
+    std::string path;
+
+#ifdef _WIN32
+    HMODULE module = nullptr;
+    char    buf[MAX_PATH];
+
+    if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, (LPCSTR) &library_dir, &module)) {
+        const DWORD n = GetModuleFileNameA(module, buf, sizeof(buf));
+        if (n > 0 && n < sizeof(buf)) {
+            path.assign(buf, n);
+        }
+    }
+#else
+    Dl_info info;
+    if (dladdr((void *) &library_dir, &info) != 0 && info.dli_fname != nullptr) {
+        path = info.dli_fname;
+    }
+#endif
+
+    const size_t sep = path.find_last_of("/\\");
+
+    return sep == std::string::npos ? std::string() : path.substr(0, sep);
+}
+
+// The desktop builds ship the ggml backends, including one CPU backend per instruction set level,
+// as modules next to this library. ggml scores each CPU variant against the host and loads the best
+static void load_backends() {
+    const std::string dir = library_dir();
+
+    if (!dir.empty()) {
+        ggml_backend_load_all_from_path(dir.c_str());
+    }
+
+    if (ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU) == nullptr) {
+        ggml_backend_load_all();
+    }
+}
+
+static std::once_flag g_backends_loaded;
+
+struct llama_model * lcpp_model_acquire(const char * path_model, struct llama_model_params params) {
+    std::call_once(g_backends_loaded, load_backends);
+
+    const lcpp_model_key key(path_model, params.use_mmap, params.use_mlock, params.vocab_only);
+
+    // loads are serialized so that two isolates asking for the same model never load it twice
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+    auto it = g_registry.find(key);
+    if (it != g_registry.end()) {
+        it->second.n_refs++;
+        g_registry_stats.n_refs++;
+        g_registry_stats.n_hits++;
+        return it->second.model;
+    }
+
+    const auto t_start = std::chrono::steady_clock::now();
+
+    llama_model * model = llama_load_model_from_file(path_model, params);
+    if (model == nullptr) {
+        return nullptr;
+    }
+
+    g_registry.emplace(key, lcpp_model_entry { model, 1 });
+
+    g_registry_stats.n_models++;
+    g_registry_stats.n_refs++;
+    g_registry_stats.n_loads++;
+    g_registry_stats.n_bytes   += llama_model_size(model);
+    g_registry_stats.t_load_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+
+    return model;
+}
+
+// cached grammar samplers hold on to the vocab of the model they were parsed for
+static void grammar_cache_evict(const llama_vocab * vocab);
+
+void lcpp_model_release(struct llama_model * model) {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+    for (auto it = g_registry.begin(); it != g_registry.end(); ++it) {
+        if (it->second.model != model) {
+            continue;
+        }
+
+        g_registry_stats.n_refs--;
+
+        if (--it->second.n_refs == 0) {
+            g_registry_stats.n_models--;
+            g_registry_stats.n_bytes -= llama_model_size(model);
+
+            grammar_cache_evict(llama_model_get_vocab(model));
+
+            for (auto it_adapter = g_adapters.begin(); it_adapter != g_adapters.end(); ) {
+                if (it_adapter->first.first == model) {
+                    llama_adapter_lora_free(it_adapter->second.adapter);
+                    it_adapter = g_adapters.erase(it_adapter);
+                } else {
+                    ++it_adapter;
+                }
+            }
+
+            llama_free_model(model);
+            g_registry.erase(it);
+        }
+
+        return;
+    }
+}
+
+struct lcpp_model_registry_stats lcpp_model_registry_get_stats(void) {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+    return g_registry_stats;
+}
+
+bool lcpp_model_is_loaded(const char * path_model, struct llama_model_params params) {
+    const lcpp_model_key key(path_model, params.use_mmap, params.use_mlock, params.vocab_only);
+
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+    return g_registry.find(key) != g_registry.end();
+}
+
+struct llama_adapter_lora * lcpp_adapter_acquire(struct llama_model * model, const char * path_lora) {
+    const lcpp_adapter_key key(model, path_lora);
+
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+    auto it = g_adapters.find(key);
+    if (it != g_adapters.end()) {
+        it->second.n_refs++;
+        return it->second.adapter;
+    }
+
+    llama_adapter_lora * adapter = llama_adapter_lora_init(model, path_lora);
+    if (adapter == nullptr) {
+        return nullptr;
+    }
+
+    g_adapters.emplace(key, lcpp_adapter_entry { adapter, 1 });
+
+    return adapter;
+}
+
+void lcpp_adapter_release(struct llama_adapter_lora * adapter) {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+    for (auto it = g_adapters.begin(); it != g_adapters.end(); ++it) {
+        if (it->second.adapter != adapter) {
+            continue;
+        }
+
+        if (--it->second.n_refs == 0) {
+            llama_adapter_lora_free(adapter);
+            g_adapters.erase(it);
+        }
+
+        return;
+    }
+}
+
+// Integer metadata, per-layer arrays give their largest value
+static int64_t gguf_int(const gguf_context * ctx, const std::string & key, int64_t fallback) {
+    const int64_t id = gguf_find_key(ctx, key.c_str());
+    if (id < 0) {
+        return fallback;
+    }
+
+    const auto value = [](enum gguf_type type, const void * data) -> int64_t {
+        switch (type) {
+            case GGUF_TYPE_UINT8:  return *(const uint8_t  *) data;
+            case GGUF_TYPE_INT8:   return *(const int8_t   *) data;
+            case GGUF_TYPE_UINT16: return *(const uint16_t *) data;
+            case GGUF_TYPE_INT16:  return *(const int16_t  *) data;
+            case GGUF_TYPE_UINT32: return *(const uint32_t *) data;
+            case GGUF_TYPE_INT32:  return *(const int32_t  *) data;
+            case GGUF_TYPE_UINT64: return (int64_t) *(const uint64_t *) data;
+            case GGUF_TYPE_INT64:  return *(const int64_t  *) data;
+            default:               return -1;
+        }
+    };
+
+    const enum gguf_type type = gguf_get_kv_type(ctx, id);
+
+    if (type != GGUF_TYPE_ARRAY) {
+        return value(type, gguf_get_val_data(ctx, id));
+    }
+
+    const enum gguf_type arr_type = gguf_get_arr_type(ctx, id);
+    if (arr_type == GGUF_TYPE_STRING || arr_type == GGUF_TYPE_ARRAY) {
+        return (int64_t) gguf_get_arr_n(ctx, id);
+    }
+
+    const size_t   n    = gguf_get_arr_n(ctx, id);
+    const size_t   size = gguf_type_size(arr_type);
+    const uint8_t * data = (const uint8_t *) gguf_get_arr_data(ctx, id);
+
+    int64_t result = fallback;
+    for (size_t i = 0; i < n; ++i) {
+        result = i == 0 ? value(arr_type, data) : std::max(result, value(arr_type, data + i * size));
+    }
+
+    return result;
+}
+
+static uint64_t gguf_tensor_bytes(const gguf_context * ctx) {
+    uint64_t n_bytes = 0;
+
+    for (int64_t i = 0; i < gguf_get_n_tensors(ctx); ++i) {
+        n_bytes += gguf_get_tensor_size(ctx, i);
+    }
+
+    return n_bytes;
+}
+
+// Every file of a model split in n_split files, given the path of its first one
+static std::vector<std::string> split_paths(const char * path_model, int32_t n_split) {
+    std::vector<std::string> paths = { path_model };
+
+    char prefix[1024];
+    char path[1024];
+
+    if (n_split <= 1 || llama_split_prefix(prefix, sizeof(prefix), path_model, 0, n_split) == 0) {
+        return paths;
+    }
+
+    for (int32_t i = 1; i < n_split; ++i) {
+        llama_split_path(path, sizeof(path), prefix, i, n_split);
+        paths.push_back(path);
+    }
+
+    return paths;
+}
+
+enum lcpp_status lcpp_model_read_info(const char * path_model, struct lcpp_model_info * info) {
+    // only the metadata and tensor descriptions are read, no tensor data is allocated
+    gguf_init_params params = { /*.no_alloc =*/ true, /*.ctx =*/ nullptr };
+
+    gguf_context * ctx = gguf_init_from_file(path_model, params);
+    if (ctx == nullptr) {
+        return LCPP_STATUS_FILE_FAILED;
+    }
+
+    const int64_t arch_id = gguf_find_key(ctx, "general.architecture");
+    const std::string arch = arch_id >= 0 ? gguf_get_val_str(ctx, arch_id) : "llama";
+
+    info->n_layer     = (int32_t) gguf_int(ctx, arch + ".block_count", 0);
+    info->n_embd      = (int32_t) gguf_int(ctx, arch + ".embedding_length", 0);
+    info->n_ff        = (int32_t) gguf_int(ctx, arch + ".feed_forward_length", 4 * info->n_embd);
+    info->n_head      = (int32_t) gguf_int(ctx, arch + ".attention.head_count", 1);
+    info->n_head_kv   = (int32_t) gguf_int(ctx, arch + ".attention.head_count_kv", info->n_head);
+    info->n_ctx_train = (int32_t) gguf_int(ctx, arch + ".context_length", 0);
+
+    const int32_t n_embd_head = info->n_head > 0 ? info->n_embd / info->n_head : 0;
+
+    info->n_embd_head_k = (int32_t) gguf_int(ctx, arch + ".attention.key_length", n_embd_head);
+    info->n_embd_head_v = (int32_t) gguf_int(ctx, arch + ".attention.value_length", n_embd_head);
+    info->n_vocab       = (int32_t) gguf_int(ctx, arch + ".vocab_size", gguf_int(ctx, "tokenizer.ggml.tokens", 0));
+
+    info->n_bytes = gguf_tensor_bytes(ctx);
+
+    // the other files of a split model only hold tensors
+    const int32_t n_split = (int32_t) gguf_int(ctx, "split.count", 1);
+
+    gguf_free(ctx);
+
+    const std::vector<std::string> paths = split_paths(path_model, n_split);
+    if ((int32_t) paths.size() != n_split) {
+        return LCPP_STATUS_FILE_FAILED;
+    }
+
+    for (size_t i = 1; i < paths.size(); ++i) {
+        gguf_context * split = gguf_init_from_file(paths[i].c_str(), params);
+        if (split == nullptr) {
+            return LCPP_STATUS_FILE_FAILED;
+        }
+
+        info->n_bytes += gguf_tensor_bytes(split);
+        gguf_free(split);
+    }
+
+    return LCPP_STATUS_OK;
+}
+
+//
+// Prefetch
+//
+
+struct lcpp_prefetch {
+    std::thread        thread;
+    std::atomic<bool>  stop     { false };
+    std::atomic<float> progress { 0.0f };
+};
+
+// page cache warm-up granularity, also how often stop is checked
+#define LCPP_PREFETCH_CHUNK_SIZE (16u << 20)
+
+// Reads the file through the page cache, so that the pages of the model's own mapping are resident
+// by the time a decode touches them. Returns the bytes read
+static uint64_t prefetch_file(const std::string & path, uint64_t n_done, uint64_t n_total, lcpp_prefetch * prefetch) {
+    const uint64_t chunk = LCPP_PREFETCH_CHUNK_SIZE;
+    uint64_t n_read = 0;
+
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> buf(chunk);
+
+    while (file && !prefetch->stop) {
+        file.read(buf.data(), (std::streamsize) chunk);
+        n_read += (uint64_t) file.gcount();
+
+        prefetch->progress = (float) (n_done + n_read) / n_total;
+    }
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    const uint64_t size = (uint64_t) st.st_size;
+    void * addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        return 0;
+    }
+
+    const uint64_t n_page = (uint64_t) sysconf(_SC_PAGESIZE);
+    const volatile uint8_t * data = (const volatile uint8_t *) addr;
+
+    for (; n_read < size && !prefetch->stop; n_read += std::min(chunk, size - n_read)) {
+        const uint64_t n = std::min(chunk, size - n_read);
+
+        // the hint lets the kernel issue large reads, touching every page then waits for them
+        madvise((uint8_t *) addr + n_read, n, MADV_WILLNEED);
+
+        uint8_t sum = 0;
+        for (uint64_t i = 0; i < n; i += n_page) {
+            sum += data[n_read + i];
+        }
+        (void) sum;
+
+        prefetch->progress = (float) (n_done + n_read + n) / n_total;
+    }
+
+    munmap(addr, size);
+#endif
+
+    return n_read;
+}
+
+static uint64_t file_size(const std::string & path) {
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    return file ? (uint64_t) file.tellg() : 0;
+#else
+    struct stat st;
+
+    return stat(path.c_str(), &st) == 0 ? (uint64_t) st.st_size : 0;
+#endif
+}
+
+struct lcpp_prefetch * lcpp_prefetch_start(const char * path_model) {
+    lcpp_prefetch * prefetch = new lcpp_prefetch;
+
+    prefetch->thread = std::thread([prefetch, path = std::string(path_model)]() {
+        gguf_init_params params = { /*.no_alloc =*/ true, /*.ctx =*/ nullptr };
+
+        int32_t n_split = 1;
+
+        gguf_context * ctx = gguf_init_from_file(path.c_str(), params);
+        if (ctx != nullptr) {
+            n_split = (int32_t) gguf_int(ctx, "split.count", 1);
+            gguf_free(ctx);
+        }
+
+        const std::vector<std::string> paths = split_paths(path.c_str(), n_split);
+
+        uint64_t n_total = 0;
+        for (const auto & file : paths) {
+            n_total += file_size(file);
+        }
+
+        uint64_t n_done = 0;
+        for (const auto & file : paths) {
+            if (prefetch->stop || n_total == 0) {
+                break;
+            }
+
+            n_done += prefetch_file(file, n_done, n_total, prefetch);
+        }
+
+        prefetch->progress = 1.0f;
+    });
+
+    return prefetch;
+}
+
+float lcpp_prefetch_progress(const struct lcpp_prefetch * prefetch) {
+    return prefetch->progress;
+}
+
+void lcpp_prefetch_free(struct lcpp_prefetch * prefetch) {
+    prefetch->stop = true;
+    prefetch->thread.join();
+
+    delete prefetch;
+}
+
+//
+// Threadpools
+//
+
+struct lcpp_threadpool_entry {
+    ggml_threadpool_params params;
+    ggml_threadpool *      threadpool;
+    int32_t                n_refs;
+
+    // a pool computes one graph at a time, contexts sharing it take turns
+    std::mutex mutex;
+};
+
+static std::mutex                                                 g_threadpool_mutex;
+static std::list<lcpp_threadpool_entry>                           g_threadpools;
+static std::map<const llama_context *, std::vector<std::mutex *>> g_threadpool_users;
+
+// With GGML_BACKEND_DL the threadpool functions live in whichever CPU backend variant was loaded
+template <typename T>
+static T cpu_proc_address(const char * name) {
+    ggml_backend_dev_t cpu = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    if (cpu == nullptr) {
+        return nullptr;
+    }
+
+    return (T) ggml_backend_reg_get_proc_address(ggml_backend_dev_backend_reg(cpu), name);
+}
+
+void lcpp_numa_init(enum ggml_numa_strategy numa) {
+    std::call_once(g_backends_loaded, load_backends);
+
+    static std::once_flag numa_initialized;
+    std::call_once(numa_initialized, llama_numa_init, numa);
+}
+
+struct ggml_threadpool * lcpp_threadpool_acquire(const struct ggml_threadpool_params * params) {
+    std::call_once(g_backends_loaded, load_backends);
+
+    std::lock_guard<std::mutex> lock(g_threadpool_mutex);
+
+    for (auto & entry : g_threadpools) {
+        if (ggml_threadpool_params_match(&entry.params, params)) {
+            entry.n_refs++;
+            return entry.threadpool;
+        }
+    }
+
+    using threadpool_new_t = ggml_threadpool * (*)(ggml_threadpool_params *);
+
+    auto threadpool_new = cpu_proc_address<threadpool_new_t>("ggml_threadpool_new");
+    if (threadpool_new == nullptr) {
+        return nullptr;
+    }
+
+    g_threadpools.emplace_back();
+
+    lcpp_threadpool_entry & entry = g_threadpools.back();
+    entry.params     = *params;
+    entry.threadpool = threadpool_new(&entry.params);
+    entry.n_refs     = 1;
+
+    if (entry.threadpool == nullptr) {
+        g_threadpools.pop_back();
+        return nullptr;
+    }
+
+    return entry.threadpool;
+}
+
+void lcpp_threadpool_release(struct ggml_threadpool * threadpool) {
+    std::lock_guard<std::mutex> lock(g_threadpool_mutex);
+
+    for (auto it = g_threadpools.begin(); it != g_threadpools.end(); ++it) {
+        if (it->threadpool != threadpool) {
+            continue;
+        }
+
+        if (--it->n_refs == 0) {
+            using threadpool_free_t = void (*)(ggml_threadpool *);
+
+            auto threadpool_free = cpu_proc_address<threadpool_free_t>("ggml_threadpool_free");
+            if (threadpool_free != nullptr) {
+                threadpool_free(threadpool);
+            }
+
+            g_threadpools.erase(it);
+        }
+
+        return;
+    }
+}
+
+void lcpp_threadpool_attach(struct llama_context * ctx, struct ggml_threadpool * threadpool, struct ggml_threadpool * threadpool_batch) {
+    std::lock_guard<std::mutex> lock(g_threadpool_mutex);
+
+    std::vector<std::mutex *> & mutexes = g_threadpool_users[ctx];
+    mutexes.clear();
+
+    for (auto & entry : g_threadpools) {
+        if (entry.threadpool == threadpool || entry.threadpool == threadpool_batch) {
+            mutexes.push_back(&entry.mutex);
+        }
+    }
+
+    llama_attach_threadpool(ctx, threadpool, threadpool_batch);
+}
+
+void lcpp_threadpool_detach(struct llama_context * ctx) {
+    std::lock_guard<std::mutex> lock(g_threadpool_mutex);
+
+    g_threadpool_users.erase(ctx);
+    llama_detach_threadpool(ctx);
+}
+
+// llama_decode, or llama_encode, waiting for the threadpools ctx shares with other contexts
+static int32_t context_decode(struct llama_context * ctx, llama_batch batch, bool encode = false) {
+    std::vector<std::mutex *> mutexes;
+
+    {
+        std::lock_guard<std::mutex> lock(g_threadpool_mutex);
+
+        auto it = g_threadpool_users.find(ctx);
+        if (it != g_threadpool_users.end()) {
+            mutexes = it->second;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock_0;
+    std::unique_lock<std::mutex> lock_1;
+
+    if (mutexes.size() == 1) {
+        lock_0 = std::unique_lock<std::mutex>(*mutexes[0]);
+    } else if (mutexes.size() == 2) {
+        std::lock(*mutexes[0], *mutexes[1]);
+        lock_0 = std::unique_lock<std::mutex>(*mutexes[0], std::adopt_lock);
+        lock_1 = std::unique_lock<std::mutex>(*mutexes[1], std::adopt_lock);
+    }
+
+    return encode ? llama_encode(ctx, batch) : llama_decode(ctx, batch);
+}
+
+int32_t lcpp_backend_info(char * buf, int32_t length) {
+    std::string info;
+
+    for (size_t i = 0; i < ggml_backend_dev_count(); ++i) {
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+        ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+
+        info += ggml_backend_reg_name(reg);
+        info += ": ";
+        info += ggml_backend_dev_name(dev);
+        info += " (";
+        info += ggml_backend_dev_description(dev);
+        info += ")";
+
+        // only the CPU backend reports the features it was compiled with
+        auto get_features = (ggml_backend_get_features_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_get_features");
+        if (get_features != nullptr) {
+            for (const ggml_backend_feature * feature = get_features(reg); feature->name != nullptr; ++feature) {
+                info += " ";
+                info += feature->name;
+                info += "=";
+                info += feature->value;
+            }
+        }
+
+        info += "\n";
+    }
+
+    if (length > 0) {
+        const size_t n = std::min(info.size(), (size_t) length - 1);
+
+        std::memcpy(buf, info.data(), n);
+        buf[n] = '\0';
+    }
+
+    return (int32_t) info.size();
+}
+
+//
+// Grammars
+//
+
+// parsed grammars kept around, the least recently used one is dropped beyond this
+#define LCPP_GRAMMAR_CACHE_SIZE 64
+
+struct lcpp_grammar_entry {
+    size_t              hash;
+    const llama_vocab * vocab;
+    bool                json_schema;
+    std::string         grammar;
+    std::string         root;
+
+    // parsed once, callers get clones which copy the rules without reparsing them
+    llama_sampler * sampler;
+};
+
+static std::mutex                                                          g_grammar_mutex;
+static std::list<lcpp_grammar_entry>                                       g_grammars; // most recently used first
+static std::unordered_map<size_t, std::list<lcpp_grammar_entry>::iterator> g_grammar_index;
+
+static size_t grammar_hash(const llama_vocab * vocab, const std::string & grammar, const std::string & root, bool json_schema) {
+    size_t hash = std::hash<std::string>()(grammar);
+
+    for (const size_t value : { std::hash<std::string>()(root), std::hash<const void *>()(vocab), (size_t) json_schema }) {
+        hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    }
+
+    return hash;
+}
+
+static void grammar_cache_erase(std::list<lcpp_grammar_entry>::iterator it) {
+    llama_sampler_free(it->sampler);
+    g_grammar_index.erase(it->hash);
+    g_grammars.erase(it);
+}
+
+static void grammar_cache_evict(const llama_vocab * vocab) {
+    std::lock_guard<std::mutex> lock(g_grammar_mutex);
+
+    for (auto it = g_grammars.begin(); it != g_grammars.end();) {
+        auto next = std::next(it);
+
+        if (it->vocab == vocab) {
+            grammar_cache_erase(it);
+        }
+
+        it = next;
+    }
+}
+
+static void write_error(char * error, int32_t n_error, const std::string & message) {
+    if (error != nullptr && n_error > 0) {
+        const size_t n = std::min(message.size(), (size_t) n_error - 1);
+
+        std::memcpy(error, message.data(), n);
+        error[n] = '\0';
+    }
+}
+
+struct llama_sampler * lcpp_grammar_init(const struct llama_vocab * vocab, const char * grammar, const char * root, bool json_schema, char * error, int32_t n_error) {
+    const std::string grammar_str(grammar);
+    const std::string root_str(json_schema || root == nullptr ? "root" : root);
+    const size_t      hash = grammar_hash(vocab, grammar_str, root_str, json_schema);
+
+    std::lock_guard<std::mutex> lock(g_grammar_mutex);
+
+    auto it = g_grammar_index.find(hash);
+    if (it != g_grammar_index.end()) {
+        const lcpp_grammar_entry & entry = *it->second;
+
+        if (entry.vocab == vocab && entry.json_schema == json_schema && entry.root == root_str && entry.grammar == grammar_str) {
+            g_grammars.splice(g_grammars.begin(), g_grammars, it->second);
+            return llama_sampler_clone(entry.sampler);
+        }
+
+        // hash collision, the newer grammar takes the slot
+        grammar_cache_erase(it->second);
+    }
+
+    std::string gbnf;
+
+    if (json_schema) {
+        try {
+            gbnf = json_schema_to_grammar(nlohmann::ordered_json::parse(grammar_str));
+        } catch (const std::exception & e) {
+            write_error(error, n_error, std::string("Invalid JSON schema: ") + e.what());
+            return nullptr;
+        }
+    } else {
+        gbnf = grammar_str;
+    }
+
+    llama_sampler * sampler = llama_sampler_init_grammar(vocab, gbnf.c_str(), root_str.c_str());
+    if (sampler == nullptr) {
+        write_error(error, n_error, json_schema ? "Failed to parse the grammar of the JSON schema" : "Failed to parse grammar");
+        return nullptr;
+    }
+
+    g_grammars.push_front(lcpp_grammar_entry { hash, vocab, json_schema, grammar_str, root_str, sampler });
+    g_grammar_index[hash] = g_grammars.begin();
+
+    if (g_grammars.size() > LCPP_GRAMMAR_CACHE_SIZE) {
+        grammar_cache_erase(std::prev(g_grammars.end()));
+    }
+
+    return llama_sampler_clone(sampler);
+}
+
+//
+// Sessions
+//
+
+static const uint32_t LCPP_SESSION_MAGIC   = 0x7370636c; // "lcps"
+static const uint32_t LCPP_SESSION_VERSION = 1;
+
+struct lcpp_session_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fingerprint;
+
+    // sizes of the context the session was saved from
+    uint32_t n_ctx;
+    uint32_t n_batch;
+    uint32_t n_ubatch;
+    uint32_t n_seq_max;
+
+    int32_t  n_tokens;
+    uint32_t reserved;
+    uint64_t n_state;
+};
+
+// FNV-1a hash of what identifies a model without reading its weights
+static uint64_t model_fingerprint(const llama_model * model) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    const auto mix = [&hash](const void * data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= ((const uint8_t *) data)[i];
+            hash *= 0x100000001b3ULL;
+        }
+    };
+
+    char desc[256];
+    const int32_t n_desc = llama_model_desc(model, desc, sizeof(desc));
+    mix(desc, std::min<size_t>(std::max(n_desc, 0), sizeof(desc) - 1));
+
+    const uint64_t values[] = {
+        llama_model_size(model),
+        llama_model_n_params(model),
+        (uint64_t) llama_model_n_embd(model),
+        (uint64_t) llama_model_n_layer(model),
+        (uint64_t) llama_vocab_n_tokens(llama_model_get_vocab(model)),
+    };
+    mix(values, sizeof(values));
+
+    return hash;
+}
+
+// Read-only view of a whole file, memory mapped where the platform allows it
+struct lcpp_file_view {
+    const uint8_t * data = nullptr;
+    size_t          size = 0;
+
+#ifdef _WIN32
+    std::vector<uint8_t> buffer;
+
+    explicit lcpp_file_view(const char * path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            return;
+        }
+
+        buffer.resize((size_t) file.tellg());
+        file.seekg(0);
+
+        if (file.read((char *) buffer.data(), buffer.size())) {
+            data = buffer.data();
+            size = buffer.size();
+        }
+    }
+#else
+    explicit lcpp_file_view(const char * path) {
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void * addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                data = (const uint8_t *) addr;
+                size = st.st_size;
+            }
+        }
+
+        close(fd);
+    }
+
+    ~lcpp_file_view() {
+        if (data != nullptr) {
+            munmap((void *) data, size);
+        }
+    }
+#endif
+
+    lcpp_file_view(const lcpp_file_view &) = delete;
+    lcpp_file_view & operator=(const lcpp_file_view &) = delete;
+};
+
+enum lcpp_status lcpp_session_save(
+        struct llama_context * ctx,
+                  const char * path,
+           const llama_token * tokens,
+                     int32_t   n_tokens) {
+    std::vector<uint8_t> state(llama_state_seq_get_size(ctx, 0));
+    if (llama_state_seq_get_data(ctx, state.data(), state.size(), 0) != state.size()) {
+        return LCPP_STATUS_SESSION_MISMATCH;
+    }
+
+    lcpp_session_header header = {};
+    header.magic       = LCPP_SESSION_MAGIC;
+    header.version     = LCPP_SESSION_VERSION;
+    header.fingerprint = model_fingerprint(llama_get_model(ctx));
+    header.n_ctx       = llama_n_ctx(ctx);
+    header.n_batch     = llama_n_batch(ctx);
+    header.n_ubatch    = llama_n_ubatch(ctx);
+    header.n_seq_max   = llama_n_seq_max(ctx);
+    header.n_tokens    = n_tokens;
+    header.n_state     = state.size();
+
+    FILE * file = std::fopen(path, "wb");
+    if (file == nullptr) {
+        return LCPP_STATUS_FILE_FAILED;
+    }
+
+    bool written =
+        std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+        std::fwrite(tokens, sizeof(llama_token), n_tokens, file) == (size_t) n_tokens &&
+        std::fwrite(state.data(), 1, state.size(), file) == state.size();
+
+    written = std::fclose(file) == 0 && written;
+
+    return written ? LCPP_STATUS_OK : LCPP_STATUS_FILE_FAILED;
+}
+
+enum lcpp_status lcpp_session_load(
+        struct llama_context * ctx,
+                  const char * path,
+                 llama_token * tokens,
+                     int32_t   n_capacity,
+                     int32_t * n_tokens) {
+    const lcpp_file_view file(path);
+    if (file.data == nullptr || file.size < sizeof(lcpp_session_header)) {
+        return LCPP_STATUS_FILE_FAILED;
+    }
+
+    lcpp_session_header header;
+    std::memcpy(&header, file.data, sizeof(header));
+
+    if (header.magic != LCPP_SESSION_MAGIC || header.version != LCPP_SESSION_VERSION || header.n_tokens < 0) {
+        return LCPP_STATUS_FILE_FAILED;
+    }
+
+    const size_t n_token_bytes = (size_t) header.n_tokens * sizeof(llama_token);
+    if (file.size < sizeof(header) + n_token_bytes + header.n_state) {
+        return LCPP_STATUS_FILE_FAILED;
+    }
+
+    if (header.fingerprint != model_fingerprint(llama_get_model(ctx)) ||
+        header.n_tokens > n_capacity || header.n_tokens > (int32_t) llama_n_ctx(ctx)) {
+        return LCPP_STATUS_SESSION_MISMATCH;
+    }
+
+    llama_kv_cache_seq_rm(ctx, 0, -1, -1);
+    *n_tokens = 0;
+
+    // the KV cache is restored straight from the mapped file
+    if (llama_state_seq_set_data(ctx, file.data + sizeof(header) + n_token_bytes, header.n_state, 0) == 0) {
+        return LCPP_STATUS_SESSION_MISMATCH;
+    }
+
+    std::memcpy(tokens, file.data + sizeof(header), n_token_bytes);
+    *n_tokens = header.n_tokens;
+
+    return LCPP_STATUS_OK;
+}
+
+//
+// Streams
+//
+
+struct lcpp_stream {
+    lcpp_ring<char>        text;
+    lcpp_ring<llama_token> tokens;
+
+    lcpp_stream_callback callback;
+    void *               user_data;
+
+    // set when the reader has been notified and has not peeked since
+    std::atomic<bool> notified { false };
+
+    lcpp_stream(int32_t n_text, int32_t n_tokens, lcpp_stream_callback callback, void * user_data)
+        : text(n_text), tokens(n_tokens), callback(callback), user_data(user_data) {}
+};
+
+struct lcpp_stream * lcpp_stream_init(int32_t n_text, int32_t n_tokens, lcpp_stream_callback callback, void * user_data) {
+    if (n_text <= 0 || n_tokens <= 0) {
+        return nullptr;
+    }
+
+    return new lcpp_stream(n_text, n_tokens, callback, user_data);
+}
+
+void lcpp_stream_free(struct lcpp_stream * stream) {
+    delete stream;
+}
+
+int32_t lcpp_stream_peek_text(struct lcpp_stream * stream, const char ** text) {
+    stream->notified.store(false);
+
+    return (int32_t) stream->text.peek(text);
+}
+
+void lcpp_stream_consume_text(struct lcpp_stream * stream, int32_t n) {
+    stream->text.consume(n);
+}
+
+int32_t lcpp_stream_peek_tokens(struct lcpp_stream * stream, const llama_token ** tokens) {
+    stream->notified.store(false);
+
+    return (int32_t) stream->tokens.peek(tokens);
+}
+
+void lcpp_stream_consume_tokens(struct lcpp_stream * stream, int32_t n) {
+    stream->tokens.consume(n);
+}
+
+static void stream_notify(struct lcpp_stream * stream) {
+    if (stream->callback != nullptr && !stream->notified.exchange(true)) {
+        stream->callback(stream->user_data);
+    }
+}
+
+// Writes all n elements, waiting for the reader while the ring is full.
+// Returns false if the abort flag was set before everything was written, which is how a reader that
+// stalls or goes away releases the generation thread
+template <typename T>
+static bool stream_write(struct lcpp_stream * stream, lcpp_ring<T> & ring, const T * data, size_t n, const bool * abort) {
+    // the flag is set from another thread while this one waits, so it is read again on every pass
+    const volatile bool * aborted = abort;
+
+    while (true) {
+        const size_t written = ring.write(data, n);
+
+        data += written;
+        n    -= written;
+
+        if (n == 0) {
+            return true;
+        }
+
+        stream_notify(stream);
+
+        if (aborted != nullptr && *aborted) {
+            return false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+//
+// Generation
+//
+
+struct lcpp_generate_params lcpp_generate_default_params(void) {
+    struct lcpp_generate_params result = {
+        /*.text_callback              =*/ nullptr,
+        /*.text_callback_user_data    =*/ nullptr,
+        /*.prefill_callback           =*/ nullptr,
+        /*.prefill_callback_user_data =*/ nullptr,
+        /*.probs_callback             =*/ nullptr,
+        /*.probs_callback_user_data   =*/ nullptr,
+        /*.n_probs                    =*/ 0,
+        /*.history                    =*/ nullptr,
+        /*.n_history                  =*/ nullptr,
+        /*.n_keep                     =*/ -1,
+        /*.n_flush_tokens             =*/ 1,
+        /*.t_flush_ms                 =*/ 0.0,
+        /*.abort                      =*/ nullptr,
+        /*.stream                     =*/ nullptr,
+        /*.draft                      =*/ nullptr,
+        /*.timings                    =*/ nullptr,
+    };
+
+    return result;
+}
+
+// Makes room for n_tokens more tokens in sequence 0 by discarding the oldest half of the tokens after
+// the first n_keep and shifting the rest back in place. The K-shift is applied by the next decode, which
+// also compacts the freed cells once fragmentation passes the context's defrag_thold.
+// Returns false if the tokens cannot fit
+static bool make_room(struct llama_context * ctx, int32_t n_tokens, const struct lcpp_generate_params & params) {
+    const int32_t n_ctx = llama_n_ctx(ctx);
+
+    while (llama_get_kv_cache_used_cells(ctx) + n_tokens > n_ctx) {
+        if (params.n_keep < 0 || !llama_kv_cache_can_shift(ctx)) {
+            return false;
+        }
+
+        const int32_t n_past    = llama_kv_cache_seq_pos_max(ctx, 0) + 1;
+        const int32_t n_discard = (n_past - params.n_keep) / 2;
+
+        if (n_discard <= 0) {
+            return false;
+        }
+
+        llama_kv_cache_seq_rm (ctx, 0, params.n_keep, params.n_keep + n_discard);
+        llama_kv_cache_seq_add(ctx, 0, params.n_keep + n_discard, n_past, -n_discard);
+
+        if (params.history != nullptr) {
+            std::copy(params.history + params.n_keep + n_discard, params.history + *params.n_history, params.history + params.n_keep);
+            *params.n_history -= n_discard;
+        }
+    }
+
+    return true;
+}
+
+// Decodes a batch for sequence 0, shifting the context or refusing the batch when it would not fit
+static enum lcpp_status decode(struct llama_context * ctx, llama_batch batch, const struct lcpp_generate_params & params) {
+    if (!make_room(ctx, batch.n_tokens, params)) {
+        return LCPP_STATUS_CONTEXT_FULL;
+    }
+
+    if (context_decode(ctx, batch) != 0) {
+        return LCPP_STATUS_DECODE_FAILED;
+    }
+
+    if (params.history != nullptr) {
+        std::copy(batch.token, batch.token + batch.n_tokens, params.history + *params.n_history);
+        *params.n_history += batch.n_tokens;
+    }
+
+    return LCPP_STATUS_OK;
+}
+
+//
+// Embeddings
+//
+
+enum lcpp_status lcpp_embed(
+        struct llama_context * ctx,
+           const llama_token * tokens,
+               const int32_t * n_tokens,
+                     int32_t   n_inputs,
+                        bool   normalize,
+                       float * out) {
+    if (llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_NONE) {
+        return LCPP_STATUS_NO_EMBEDDINGS;
+    }
+
+    const llama_model * model = llama_get_model(ctx);
+
+    const int32_t n_embd    = llama_model_n_embd(model);
+    const int32_t n_seq_max = llama_n_seq_max(ctx);
+
+    // a sequence split across ubatches would be pooled over its last slice only, and non-causal
+    // attention cannot split one at all, so every decode has to fit in a single ubatch
+    const int32_t n_batch = std::min(llama_n_batch(ctx), llama_n_ubatch(ctx));
+
+    // encoder-only models have no KV cache to go through
+    const bool encode = llama_model_has_encoder(model) && !llama_model_has_decoder(model);
+
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+
+    enum lcpp_status status = LCPP_STATUS_OK;
+
+    for (int32_t first = 0, offset = 0; first < n_inputs && status == LCPP_STATUS_OK; ) {
+        int32_t last = first;
+
+        batch.n_tokens = 0;
+
+        while (last < n_inputs && last - first < n_seq_max && batch.n_tokens + n_tokens[last] <= n_batch) {
+            for (int32_t j = 0; j < n_tokens[last]; ++j) {
+                batch_add(batch, tokens[offset + j], j, last - first, true);
+            }
+
+            offset += n_tokens[last];
+            last++;
+        }
+
+        if (last == first) {
+            status = LCPP_STATUS_CONTEXT_FULL;
+            break;
+        }
+
+        llama_kv_cache_clear(ctx);
+
+        if (context_decode(ctx, batch, encode) != 0) {
+            status = LCPP_STATUS_DECODE_FAILED;
+            break;
+        }
+
+        for (int32_t i = first; i < last; ++i) {
+            float * row = out + (size_t) i * n_embd;
+
+            if (n_tokens[i] == 0) {
+                std::fill(row, row + n_embd, 0.0f);
+                continue;
+            }
+
+            const float * embd = llama_get_embeddings_seq(ctx, i - first);
+            if (embd == nullptr) {
+                status = LCPP_STATUS_NO_EMBEDDINGS;
+                break;
+            }
+
+            double norm = 0.0;
+            for (int32_t j = 0; j < n_embd; ++j) {
+                norm += embd[j] * embd[j];
+            }
+
+            const float scale = normalize && norm > 0.0 ? (float) (1.0 / std::sqrt(norm)) : 1.0f;
+
+            for (int32_t j = 0; j < n_embd; ++j) {
+                row[j] = embd[j] * scale;
+            }
+        }
+
+        first = last;
+    }
+
+    llama_kv_cache_clear(ctx);
+    llama_batch_free(batch);
+
+    return status;
+}
+
+//
+// Scoring
+//
+
+static float logsumexp(const float * logits, int32_t n_vocab) {
+    const float max = *std::max_element(logits, logits + n_vocab);
+
+    double sum = 0.0;
+    for (int32_t i = 0; i < n_vocab; ++i) {
+        sum += std::exp(logits[i] - max);
+    }
+
+    return max + (float) std::log(sum);
+}
+
+enum lcpp_status lcpp_score(
+        struct llama_context * ctx,
+           const llama_token * tokens,
+                     int32_t   n_tokens,
+           const llama_token * candidates,
+               const int32_t * n_candidate_tokens,
+                     int32_t   n_candidates,
+                       float * logprobs,
+ struct lcpp_generate_params   params) {
+    if (n_tokens < 1) {
+        return LCPP_STATUS_DECODE_FAILED;
+    }
+
+    const llama_vocab * vocab = llama_model_get_vocab(llama_get_model(ctx));
+
+    const int32_t n_vocab   = llama_vocab_n_tokens(vocab);
+    const int32_t n_batch   = llama_n_batch(ctx);
+    const int32_t n_seq_max = llama_n_seq_max(ctx);
+
+    llama_token * prompt = const_cast<llama_token *>(tokens);
+
+    for (int32_t i = 0; i < n_tokens; i += n_batch) {
+        const enum lcpp_status status = decode(ctx, llama_batch_get_one(prompt + i, std::min(n_batch, n_tokens - i)), params);
+        if (status != LCPP_STATUS_OK) {
+            return status;
+        }
+    }
+
+    // the first token of every candidate is predicted by the last prompt token
+    const float * logits_prompt = llama_get_logits_ith(ctx, -1);
+
+    const std::vector<float> logits_first(logits_prompt, logits_prompt + n_vocab);
+    const float              lse_first = logsumexp(logits_first.data(), n_vocab);
+
+    const llama_pos n_past = llama_kv_cache_seq_pos_max(ctx, 0) + 1;
+
+    // candidates continue copies of sequence 0, or sequence 0 itself one at a time when there is no other
+    const int32_t      n_slots   = std::max(1, n_seq_max - 1);
+    const llama_seq_id seq_first = n_seq_max > 1 ? 1 : 0;
+
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+
+    enum lcpp_status status = LCPP_STATUS_OK;
+
+    for (int32_t first = 0, offset = 0; first < n_candidates; ) {
+        int32_t last = first;
+
+        batch.n_tokens = 0;
+
+        while (last < n_candidates && last - first < n_slots && batch.n_tokens + n_candidate_tokens[last] <= n_batch) {
+            const llama_seq_id seq_id = seq_first + last - first;
+            const llama_token * tokens_candidate = candidates + offset + batch.n_tokens;
+
+            // the last token of a candidate predicts nothing that is scored
+            for (int32_t j = 0; j < n_candidate_tokens[last]; ++j) {
+                batch_add(batch, tokens_candidate[j], n_past + j, seq_id, j + 1 < n_candidate_tokens[last]);
+            }
+
+            last++;
+        }
+
+        if (last == first || llama_get_kv_cache_used_cells(ctx) + batch.n_tokens > (int32_t) llama_n_ctx(ctx)) {
+            status = LCPP_STATUS_CONTEXT_FULL;
+            break;
+        }
+
+        for (int32_t i = first; i < last; ++i) {
+            if (seq_first + i - first != 0) {
+                llama_kv_cache_seq_cp(ctx, 0, seq_first + i - first, -1, -1);
+            }
+        }
+
+        if (batch.n_tokens > 0 && context_decode(ctx, batch) != 0) {
+            status = LCPP_STATUS_DECODE_FAILED;
+        }
+
+        for (int32_t i = first, i_batch = 0; i < last && status == LCPP_STATUS_OK; ++i) {
+            for (int32_t j = 0; j < n_candidate_tokens[i]; ++j) {
+                const llama_token token = candidates[offset + j];
+
+                if (j == 0) {
+                    logprobs[offset] = logits_first[token] - lse_first;
+                    continue;
+                }
+
+                const float * logits = llama_get_logits_ith(ctx, i_batch + j - 1);
+                logprobs[offset + j] = logits[token] - logsumexp(logits, n_vocab);
+            }
+
+            i_batch += n_candidate_tokens[i];
+            offset  += n_candidate_tokens[i];
+        }
+
+        // only the prompt stays in the cache
+        for (int32_t i = first; i < last; ++i) {
+            const llama_seq_id seq_id = seq_first + i - first;
+            llama_kv_cache_seq_rm(ctx, seq_id, seq_id == 0 ? n_past : -1, -1);
+        }
+
+        if (status != LCPP_STATUS_OK) {
+            break;
+        }
+
+        first = last;
+    }
+
+    llama_batch_free(batch);
+
+    return status;
+}
+
+//
+// Speculative decoding
+//
+
+// some models pad their vocab, only this many extra tokens are tolerated between target and draft
+#define LCPP_DRAFT_VOCAB_MAX_SIZE_DIFF 128
+
+struct lcpp_draft {
+    llama_context * ctx;
+    int32_t         n_draft;
+    float           p_min;
+
+    // tokens held in the draft KV cache for sequence 0, or indexed by prompt lookup
+    std::vector<llama_token> tokens;
+
+    lcpp_draft_stats stats = {};
+
+    // prompt lookup, used instead of a draft model when ctx is null
+    int32_t ngram_min = 0;
+    int32_t ngram_max = 0;
+
+    // hash of an n-gram of tokens -> position of the token following its last occurrence
+    std::unordered_map<uint64_t, int32_t> ngrams = {};
+};
+
+bool lcpp_vocab_compatible(const struct llama_model * model_tgt, const struct llama_model * model_dft) {
+    const llama_vocab * vocab_tgt = llama_model_get_vocab(model_tgt);
+    const llama_vocab * vocab_dft = llama_model_get_vocab(model_dft);
+
+    if (llama_vocab_type(vocab_tgt)        != llama_vocab_type(vocab_dft)        ||
+        llama_vocab_get_add_bos(vocab_tgt) != llama_vocab_get_add_bos(vocab_dft) ||
+        llama_vocab_bos(vocab_tgt)         != llama_vocab_bos(vocab_dft)         ||
+        llama_vocab_eos(vocab_tgt)         != llama_vocab_eos(vocab_dft)) {
+        return false;
+    }
+
+    const int32_t n_vocab_tgt = llama_vocab_n_tokens(vocab_tgt);
+    const int32_t n_vocab_dft = llama_vocab_n_tokens(vocab_dft);
+
+    if (std::abs(n_vocab_tgt - n_vocab_dft) > LCPP_DRAFT_VOCAB_MAX_SIZE_DIFF) {
+        return false;
+    }
+
+    for (int32_t i = 0; i < std::min(n_vocab_tgt, n_vocab_dft); ++i) {
+        if (std::strcmp(llama_vocab_get_text(vocab_tgt, i), llama_vocab_get_text(vocab_dft, i)) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+struct lcpp_draft * lcpp_draft_init(struct llama_context * ctx, int32_t n_draft, float p_min) {
+    if (ctx == nullptr || n_draft <= 0) {
+        return nullptr;
+    }
+
+    return new lcpp_draft { ctx, n_draft, p_min, {} };
+}
+
+struct lcpp_draft * lcpp_draft_init_ngram(int32_t n_draft, int32_t n_min, int32_t n_max) {
+    if (n_draft <= 0 || n_min <= 0 || n_max < n_min) {
+        return nullptr;
+    }
+
+    lcpp_draft * draft = new lcpp_draft { nullptr, n_draft, 0.0f, {} };
+
+    draft->ngram_min = n_min;
+    draft->ngram_max = n_max;
+
+    return draft;
+}
+
+void lcpp_draft_free(struct lcpp_draft * draft) {
+    delete draft;
+}
+
+struct lcpp_draft_stats lcpp_draft_get_stats(const struct lcpp_draft * draft) {
+    return draft->stats;
+}
+
+// Brings the draft KV cache up to the n_tokens tokens and greedily drafts up to n_max tokens after them,
+// stopping early when the draft model is less confident than p_min
+static std::vector<llama_token> draft_tokens(lcpp_draft * draft, const llama_token * tokens, int32_t n_tokens, int32_t n_max) {
+    llama_context * ctx = draft->ctx;
+
+    const llama_vocab * vocab   = llama_model_get_vocab(llama_get_model(ctx));
+    const int32_t       n_vocab = llama_vocab_n_tokens(vocab);
+    const int32_t       n_ctx   = llama_n_ctx(ctx);
+    const int32_t       n_batch = llama_n_batch(ctx);
+
+    // reuse the common prefix, the last token is decoded again when everything is cached to get its logits
+    int32_t n_reused = 0;
+    while (n_reused < (int32_t) draft->tokens.size() && n_reused < n_tokens && draft->tokens[n_reused] == tokens[n_reused]) {
+        n_reused++;
+    }
+
+    if (n_reused == n_tokens) {
+        n_reused--;
+    }
+
+    if (!llama_kv_cache_seq_rm(ctx, 0, n_reused, -1)) {
+        llama_kv_cache_clear(ctx);
+        n_reused = 0;
+    }
+
+    draft->tokens.resize(n_reused);
+
+    std::vector<llama_token> result;
+
+    for (int32_t i = n_reused; i < n_tokens; i += n_batch) {
+        const int32_t n_chunk = std::min(n_batch, n_tokens - i);
+
+        if (llama_get_kv_cache_used_cells(ctx) + n_chunk > n_ctx ||
+            context_decode(ctx, llama_batch_get_one(const_cast<llama_token *>(tokens + i), n_chunk)) != 0) {
+            return result;
+        }
+
+        draft->tokens.insert(draft->tokens.end(), tokens + i, tokens + i + n_chunk);
+    }
+
+    while ((int32_t) result.size() < n_max) {
+        const float * logits = llama_get_logits_ith(ctx, -1);
+        const int32_t best   = std::max_element(logits, logits + n_vocab) - logits;
+
+        double sum = 0.0;
+        for (int32_t i = 0; i < n_vocab; ++i) {
+            sum += std::exp(logits[i] - logits[best]);
+        }
+
+        if (1.0 / sum < draft->p_min) {
+            break;
+        }
+
+        result.push_back(best);
+
+        if ((int32_t) result.size() == n_max || llama_vocab_is_eog(vocab, best)) {
+            break;
+        }
+
+        llama_token next = best;
+        if (llama_get_kv_cache_used_cells(ctx) + 1 > n_ctx || context_decode(ctx, llama_batch_get_one(&next, 1)) != 0) {
+            break;
+        }
+
+        draft->tokens.push_back(best);
+    }
+
+    return result;
+}
+
+static uint64_t ngram_hash(const llama_token * tokens, int32_t n) {
+    uint64_t hash = 14695981039346656037ULL ^ (uint64_t) n;
+    for (int32_t i = 0; i < n; ++i) {
+        hash = (hash ^ (uint32_t) tokens[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// Brings the n-gram index up to the n_tokens tokens and proposes up to n_max tokens that followed the
+// last earlier occurrence of the longest n-gram ending them
+static std::vector<llama_token> draft_ngrams(lcpp_draft * draft, const llama_token * tokens, int32_t n_tokens, int32_t n_max) {
+    std::vector<llama_token> & indexed = draft->tokens;
+
+    int32_t n_reused = 0;
+    while (n_reused < (int32_t) indexed.size() && n_reused < n_tokens && indexed[n_reused] == tokens[n_reused]) {
+        n_reused++;
+    }
+
+    // a new conversation or a context shift invalidates positions, the index is rebuilt over what is left
+    if (n_reused < (int32_t) indexed.size()) {
+        indexed.resize(n_reused);
+        draft->ngrams.clear();
+        n_reused = 0;
+    }
+
+    indexed.assign(tokens, tokens + n_tokens);
+
+    // an n-gram is indexed once the token following it is known, so the one ending the history
+    // never finds itself
+    for (int32_t i = std::max(n_reused, 1); i < n_tokens; ++i) {
+        for (int32_t n = draft->ngram_min; n <= draft->ngram_max && n <= i; ++n) {
+            draft->ngrams[ngram_hash(tokens + i - n, n)] = i;
+        }
+    }
+
+    std::vector<llama_token> result;
+
+    for (int32_t n = std::min(draft->ngram_max, n_tokens); n >= draft->ngram_min; --n) {
+        const auto it = draft->ngrams.find(ngram_hash(tokens + n_tokens - n, n));
+
+        // hashes can collide
+        if (it == draft->ngrams.end() || !std::equal(tokens + it->second - n, tokens + it->second, tokens + n_tokens - n)) {
+            continue;
+        }
+
+        const int32_t n_copy = std::min(n_max, n_tokens - it->second);
+        result.assign(tokens + it->second, tokens + it->second + n_copy);
+        break;
+    }
+
+    return result;
+}
+
+// Hands text over to the stream or the text callback, returns false to stop the generation
+static bool emit(const char * text, size_t n, const struct lcpp_generate_params & params) {
+    const auto t_start = std::chrono::steady_clock::now();
+
+    bool proceed = true;
+
+    if (params.stream != nullptr) {
+        proceed = stream_write(params.stream, params.stream->text, text, n, params.abort);
+        stream_notify(params.stream);
+    } else if (params.text_callback != nullptr) {
+        proceed = params.text_callback(text, (int32_t) n, params.text_callback_user_data);
+    }
+
+    if (params.timings != nullptr) {
+        params.timings->n_emits++;
+        params.timings->t_emit_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+    }
+
+    return proceed;
+}
+
+enum lcpp_status lcpp_generate(
+        struct llama_context * ctx,
+        struct llama_sampler * sampler,
+           const llama_token * tokens,
+                     int32_t   n_tokens,
+ struct lcpp_generate_params   params) {
+    const llama_model * model = llama_get_model(ctx);
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+
+    // llama_batch_get_one does not take a const pointer but never writes through it
+    llama_token * prompt = const_cast<llama_token *>(tokens);
+
+    // prefill in chunks of at most n_batch tokens (llama_decode splits them further into n_ubatch),
+    // so that long prompts are accepted, report progress and can be cancelled between chunks
+    const int32_t n_batch = llama_n_batch(ctx);
+    const auto t_prefill = std::chrono::steady_clock::now();
+
+    for (int32_t i = 0; i < n_tokens; i += n_batch) {
+        const int32_t n_chunk = std::min(n_batch, n_tokens - i);
+
+        const enum lcpp_status status = decode(ctx, llama_batch_get_one(prompt + i, n_chunk), params);
+        if (status != LCPP_STATUS_OK) {
+            return status;
+        }
+
+        const double t_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_prefill).count();
+
+        if (params.timings != nullptr) {
+            params.timings->t_prefill_ms = t_ms;
+        }
+
+        if (params.prefill_callback != nullptr) {
+            if (!params.prefill_callback(i + n_chunk, n_tokens, t_ms, params.prefill_callback_user_data)) {
+                return LCPP_STATUS_OK;
+            }
+        }
+    }
+
+    // bytes generated since the last flush, the head of an incomplete UTF-8 sequence stays here
+    std::string pending;
+    char piece[256];
+
+    int32_t n_unflushed = 0;
+    auto t_flush = std::chrono::steady_clock::now();
+
+    enum lcpp_status status = LCPP_STATUS_OK;
+
+    // index of the logits the last token was sampled from
+    int32_t i_sampled = -1;
+
+    // llama.cpp counts a decode of several tokens as prompt evaluation, draft verification included,
+    // so the generation's decode time is measured here
+    const auto add_decode_time = [&](std::chrono::steady_clock::time_point t_start) {
+        if (params.timings != nullptr) {
+            params.timings->t_decode_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+        }
+    };
+
+    const auto sample = [&](int32_t idx) -> llama_token {
+        i_sampled = idx;
+        return llama_sampler_sample(sampler, ctx, idx);
+    };
+
+    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+    const int32_t n_probs = params.probs_callback != nullptr ? std::max(0, std::min(params.n_probs, n_vocab)) : 0;
+
+    std::vector<llama_token> probs_ids(params.probs_callback != nullptr ? n_vocab : 0);
+    std::vector<float>       probs_top(n_probs);
+
+    // reports the raw log-probabilities of a sampled token and of the most likely ones at its position
+    const auto report_probs = [&](llama_token token) {
+        const float * logits = llama_get_logits_ith(ctx, i_sampled);
+        const float   lse    = logsumexp(logits, n_vocab);
+
+        std::iota(probs_ids.begin(), probs_ids.end(), 0);
+        std::partial_sort(probs_ids.begin(), probs_ids.begin() + n_probs, probs_ids.end(), [logits](llama_token a, llama_token b) {
+            return logits[a] > logits[b];
+        });
+
+        for (int32_t i = 0; i < n_probs; ++i) {
+            probs_top[i] = logits[probs_ids[i]] - lse;
+        }
+
+        params.probs_callback(token, logits[token] - lse, probs_ids.data(), probs_top.data(), n_probs, params.probs_callback_user_data);
+    };
+
+    // detokenizes a sampled token and hands the text over when a flush is due, returns false to stop
+    const auto accept = [&](llama_token token) -> bool {
+        if (params.probs_callback != nullptr) {
+            report_probs(token);
+        }
+
+        const auto t_piece = std::chrono::steady_clock::now();
+
+        const int32_t n = llama_token_to_piece(vocab, token, piece, sizeof(piece), 0, true);
+
+        if (params.timings != nullptr) {
+            params.timings->n_tokens++;
+            params.timings->t_detokenize_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_piece).count();
+        }
+
+        if (n < 0) {
+            status = LCPP_STATUS_DETOKENIZE_FAILED;
+            return false;
+        }
+
+        pending.append(piece, n);
+        n_unflushed++;
+
+        if (params.stream != nullptr && !stream_write(params.stream, params.stream->tokens, &token, 1, params.abort)) {
+            return false;
+        }
+
+        const auto t_now = std::chrono::steady_clock::now();
+
+        const bool flush =
+            (params.n_flush_tokens > 0 && n_unflushed >= params.n_flush_tokens) ||
+            (params.t_flush_ms > 0 && std::chrono::duration<double, std::milli>(t_now - t_flush).count() >= params.t_flush_ms);
+
+        bool proceed = true;
+
+        const size_t n_complete = flush ? utf8_complete_length(pending) : 0;
+        if (n_complete > 0) {
+            proceed = emit(pending.data(), n_complete, params);
+
+            pending.erase(0, n_complete);
+            n_unflushed = 0;
+            t_flush = t_now;
+        }
+
+        return proceed && (params.abort == nullptr || !*params.abort);
+    };
+
+    // the draft context is kept in sync with the history, so it cannot be used without it
+    lcpp_draft * draft = params.history != nullptr ? params.draft : nullptr;
+    llama_batch  batch = draft != nullptr ? llama_batch_init(draft->n_draft + 1, 0, 1) : llama_batch {};
+
+    llama_token token = sample(-1);
+
+    while (!llama_vocab_is_eog(vocab, token) && accept(token)) {
+        const auto t_step = std::chrono::steady_clock::now();
+
+        if (draft == nullptr) {
+            status = decode(ctx, llama_batch_get_one(&token, 1), params);
+            add_decode_time(t_step);
+
+            if (status != LCPP_STATUS_OK) {
+                break;
+            }
+
+            token = sample(-1);
+            continue;
+        }
+
+        // positions are assigned below, so the context is shifted first. The draft context resyncs
+        // with the shifted history on its own. Without room for a whole step the draft is shortened
+        // to what fits, the context is only full once the token itself does not
+        if (!make_room(ctx, draft->n_draft + 1, params) && !make_room(ctx, 1, params)) {
+            status = LCPP_STATUS_CONTEXT_FULL;
+            break;
+        }
+
+        const int32_t n_max = std::min(draft->n_draft, (int32_t) llama_n_ctx(ctx) - llama_get_kv_cache_used_cells(ctx) - 1);
+
+        // the draft continues the history followed by the token about to be decoded
+        std::vector<llama_token> drafted;
+        if (n_max > 0) {
+            params.history[*params.n_history] = token;
+            drafted = draft->ctx != nullptr
+                ? draft_tokens(draft, params.history, *params.n_history + 1, n_max)
+                : draft_ngrams(draft, params.history, *params.n_history + 1, n_max);
+        }
+
+        // the token and the whole draft are verified by a single decode of the target
+        const llama_pos n_past = llama_kv_cache_seq_pos_max(ctx, 0) + 1;
+
+        batch.n_tokens = 0;
+        batch_add(batch, token, n_past, 0, true);
+
+        for (size_t i = 0; i < drafted.size(); ++i) {
+            batch_add(batch, drafted[i], n_past + 1 + i, 0, true);
+        }
+
+        status = decode(ctx, batch, params);
+        add_decode_time(t_step);
+
+        if (status != LCPP_STATUS_OK) {
+            break;
+        }
+
+        // draft tokens are kept while the target samples the same ones, the first
+        // disagreement is the target's own next token
+        size_t n_accepted = 0;
+        bool   proceed    = true;
+
+        token = sample(0);
+
+        while (n_accepted < drafted.size() && token == drafted[n_accepted]) {
+            n_accepted++;
+
+            if (llama_vocab_is_eog(vocab, token) || !accept(token)) {
+                proceed = false;
+                break;
+            }
+
+            token = sample(n_accepted);
+        }
+
+        // the rejected part of the draft leaves the KV cache and the history
+        llama_kv_cache_seq_rm(ctx, 0, n_past + 1 + n_accepted, -1);
+        *params.n_history -= (int32_t) (drafted.size() - n_accepted);
+
+        draft->stats.n_steps++;
+        draft->stats.n_drafted  += drafted.size();
+        draft->stats.n_accepted += n_accepted;
+
+        if (!proceed) {
+            break;
+        }
+    }
+
+    if (draft != nullptr) {
+        llama_batch_free(batch);
+    }
+
+    // whatever is left is either still buffered or can no longer be completed, hand it over as is
+    if (!pending.empty()) {
+        emit(pending.data(), pending.size(), params);
+    }
+
+    return status;
+}
+
+//
+// Continuous batching server
+//
+
+struct lcpp_server_request {
+    int32_t         id;
+    llama_sampler * sampler;
+
+    std::vector<llama_token> prompt;
+
+    // owned by the server thread
+    llama_seq_id seq_id     = -1;
+    int32_t      n_prompt   = 0;                // prompt tokens decoded
+    llama_pos    n_past     = 0;
+    llama_token  last       = LLAMA_TOKEN_NULL; // sampled but not decoded yet
+    int32_t      n_step     = 0;                // tokens added to the current batch
+    int32_t      i_batch    = -1;               // index of the logits to sample from
+    std::string  pending;                       // text waiting for the rest of a UTF-8 sequence
+
+    // guarded by lcpp_server::mutex
+    std::string      output;
+    bool             cancelled = false;
+    bool             done      = false;
+    enum lcpp_status status    = LCPP_STATUS_OK;
+};
+
+struct lcpp_server {
+    llama_context *      ctx;
+    lcpp_server_callback callback;
+    void *               user_data;
+
+    std::thread             thread;
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    bool    running = true;
+    int32_t next_id = 0;
+
+    std::map<int32_t, std::unique_ptr<lcpp_server_request>> requests;
+    std::deque<lcpp_server_request *>                       queue;
+
+    // owned by the server thread
+    std::vector<lcpp_server_request *> slots; // request decoding in each sequence
+};
+
+static void server_finish(lcpp_server * server, lcpp_server_request * req, enum lcpp_status status) {
+    const int32_t id = req->id;
+
+    if (req->seq_id >= 0) {
+        llama_kv_cache_seq_rm(server->ctx, req->seq_id, -1, -1);
+        server->slots[req->seq_id] = nullptr;
+        req->seq_id = -1;
+    }
+
+    llama_sampler_free(req->sampler);
+    req->sampler = nullptr;
+
+    {
+        // once done is set the request may be released by lcpp_server_read at any time
+        std::lock_guard<std::mutex> lock(server->mutex);
+
+        req->output += req->pending;
+        req->done    = true;
+        req->status  = status;
+    }
+
+    server->callback(id, server->user_data);
+}
+
+static void server_loop(lcpp_server * server) {
+    llama_context     * ctx   = server->ctx;
+    const llama_vocab * vocab = llama_model_get_vocab(llama_get_model(ctx));
+
+    const int32_t n_ctx   = llama_n_ctx(ctx);
+    const int32_t n_batch = llama_n_batch(ctx);
+
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+
+    char piece[256];
+
+    while (true) {
+        std::vector<lcpp_server_request *> cancelled;
+
+        {
+            std::unique_lock<std::mutex> lock(server->mutex);
+
+            server->cv.wait(lock, [&] {
+                if (!server->running || !server->queue.empty()) {
+                    return true;
+                }
+
+                for (auto * req : server->slots) {
+                    if (req != nullptr) {
+                        return true;
+                    }
+                }
+
+                return false;
+            });
+
+            if (!server->running) {
+                break;
+            }
+
+            // admit queued requests into free sequences
+            for (size_t s = 0; s < server->slots.size() && !server->queue.empty(); ++s) {
+                if (server->slots[s] != nullptr) {
+                    continue;
+                }
+
+                auto * req = server->queue.front();
+                server->queue.pop_front();
+
+                req->seq_id      = (llama_seq_id) s;
+                server->slots[s] = req;
+            }
+
+            for (auto * req : server->slots) {
+                if (req != nullptr && req->cancelled) {
+                    cancelled.push_back(req);
+                }
+            }
+        }
+
+        for (auto * req : cancelled) {
+            server_finish(server, req, LCPP_STATUS_OK);
+        }
+
+        // one token for every generating sequence, then fill the batch with pending prompts
+        batch.n_tokens = 0;
+
+        for (auto * req : server->slots) {
+            if (req == nullptr) {
+                continue;
+            }
+
+            req->n_step  = 0;
+            req->i_batch = -1;
+
+            if (req->last != LLAMA_TOKEN_NULL) {
+                req->i_batch = batch.n_tokens;
+                req->n_step  = 1;
+                batch_add(batch, req->last, req->n_past, req->seq_id, true);
+            }
+        }
+
+        // prompt chunks only take the cells left once every generating sequence has its next one,
+        // the rest of a prompt waits for sequences to finish
+        const int32_t n_free    = n_ctx - llama_get_kv_cache_used_cells(ctx);
+        const int32_t n_prefill = std::min(n_batch, n_free);
+
+        bool prefilling = false;
+
+        for (auto * req : server->slots) {
+            if (req == nullptr) {
+                continue;
+            }
+
+            const int32_t n_prompt = (int32_t) req->prompt.size();
+
+            prefilling = prefilling || req->n_prompt < n_prompt;
+
+            while (req->n_prompt + req->n_step < n_prompt && batch.n_tokens < n_prefill) {
+                const int32_t i    = req->n_prompt + req->n_step;
+                const bool    last = i == n_prompt - 1;
+
+                if (last) {
+                    req->i_batch = batch.n_tokens;
+                }
+
+                batch_add(batch, req->prompt[i], req->n_past + req->n_step, req->seq_id, last);
+                req->n_step++;
+            }
+        }
+
+        // the context is full when the generating sequences alone do not fit, or when prompts are left
+        // and none of them can go on. A request that is still decoding its prompt loses first, then the
+        // one holding the most cells, and finishes with LCPP_STATUS_CONTEXT_FULL
+        if (batch.n_tokens > n_free || (batch.n_tokens == 0 && prefilling)) {
+            lcpp_server_request * victim = nullptr;
+
+            const auto is_prefilling = [](const lcpp_server_request * req) {
+                return req->last == LLAMA_TOKEN_NULL && req->n_prompt < (int32_t) req->prompt.size();
+            };
+
+            for (auto * req : server->slots) {
+                if (req == nullptr || req->n_past == 0) {
+                    continue;
+                }
+
+                if (victim == nullptr ||
+                    is_prefilling(req) > is_prefilling(victim) ||
+                    (is_prefilling(req) == is_prefilling(victim) && req->n_past > victim->n_past)) {
+                    victim = req;
+                }
+            }
+
+            if (victim == nullptr) {
+                // nothing holds a cell yet
+                for (auto * req : server->slots) {
+                    if (req != nullptr && victim == nullptr) {
+                        victim = req;
+                    }
+                }
+            }
+
+            server_finish(server, victim, LCPP_STATUS_CONTEXT_FULL);
+            continue;
+        }
+
+        if (batch.n_tokens == 0) {
+            continue;
+        }
+
+        if (context_decode(ctx, batch) != 0) {
+            for (auto * req : server->slots) {
+                if (req != nullptr && req->n_step > 0) {
+                    server_finish(server, req, LCPP_STATUS_DECODE_FAILED);
+                }
+            }
+            continue;
+        }
+
+        for (auto * req : server->slots) {
+            if (req == nullptr || req->n_step == 0) {
+                continue;
+            }
+
+            if (req->last != LLAMA_TOKEN_NULL) {
+                req->last = LLAMA_TOKEN_NULL;
+            } else {
+                req->n_prompt += req->n_step;
+            }
+
+            req->n_past += req->n_step;
+
+            if (req->i_batch < 0) {
+                continue;
+            }
+
+            const llama_token token = llama_sampler_sample(req->sampler, ctx, req->i_batch);
+
+            if (llama_vocab_is_eog(vocab, token)) {
+                server_finish(server, req, LCPP_STATUS_OK);
+                continue;
+            }
+
+            const int32_t n = llama_token_to_piece(vocab, token, piece, sizeof(piece), 0, true);
+            if (n < 0) {
+                server_finish(server, req, LCPP_STATUS_DETOKENIZE_FAILED);
+                continue;
+            }
+
+            req->pending.append(piece, n);
+            req->last = token;
+
+            const size_t n_complete = utf8_complete_length(req->pending);
+            if (n_complete > 0) {
+                {
+                    std::lock_guard<std::mutex> lock(server->mutex);
+                    req->output.append(req->pending, 0, n_complete);
+                }
+
+                req->pending.erase(0, n_complete);
+
+                server->callback(req->id, server->user_data);
+            }
+        }
+    }
+
+    llama_batch_free(batch);
+}
+
+struct lcpp_server * lcpp_server_init(
+        struct llama_context * ctx,
+        lcpp_server_callback   callback,
+                        void * user_data) {
+    auto * server = new lcpp_server;
+
+    server->ctx       = ctx;
+    server->callback  = callback;
+    server->user_data = user_data;
+    server->slots.resize(llama_n_seq_max(ctx), nullptr);
+
+    llama_kv_cache_clear(ctx);
+
+    server->thread = std::thread(server_loop, server);
+
+    return server;
+}
+
+void lcpp_server_free(struct lcpp_server * server) {
+    {
+        std::lock_guard<std::mutex> lock(server->mutex);
+        server->running = false;
+    }
+
+    server->cv.notify_one();
+    server->thread.join();
+
+    for (auto & it : server->requests) {
+        if (it.second->sampler != nullptr) {
+            llama_sampler_free(it.second->sampler);
+        }
+    }
+
+    llama_kv_cache_clear(server->ctx);
+
+    delete server;
+}
+
+int32_t lcpp_server_submit(
+         struct lcpp_server * server,
+  const struct llama_sampler * sampler,
+           const llama_token * tokens,
+                     int32_t   n_tokens) {
+    if (n_tokens <= 0) {
+        return -1;
+    }
+
+    auto req = std::make_unique<lcpp_server_request>();
+
+    req->sampler = llama_sampler_clone(sampler);
+    req->prompt.assign(tokens, tokens + n_tokens);
+
+    int32_t id;
+
+    {
+        std::lock_guard<std::mutex> lock(server->mutex);
+
+        id = req->id = server->next_id++;
+
+        server->queue.push_back(req.get());
+        server->requests.emplace(id, std::move(req));
+    }
+
+    server->cv.notify_one();
+
+    return id;
+}
+
+void lcpp_server_cancel(struct lcpp_server * server, int32_t request_id) {
+    bool dequeued = false;
+
+    {
+        std::lock_guard<std::mutex> lock(server->mutex);
+
+        auto it = server->requests.find(request_id);
+        if (it == server->requests.end() || it->second->done) {
+            return;
+        }
+
+        auto * req = it->second.get();
+        req->cancelled = true;
+
+        // requests still waiting for a sequence never reach the server thread
+        auto queue_it = std::find(server->queue.begin(), server->queue.end(), req);
+        if (queue_it != server->queue.end()) {
+            server->queue.erase(queue_it);
+
+            llama_sampler_free(req->sampler);
+            req->sampler = nullptr;
+            req->done    = true;
+
+            dequeued = true;
+        }
+    }
+
+    if (dequeued) {
+        server->callback(request_id, server->user_data);
+    }
+
+    server->cv.notify_one();
+}
+
+int32_t lcpp_server_read(
+         struct lcpp_server * server,
+                     int32_t   request_id,
+                        char * buf,
+                     int32_t   length,
+                        bool * done,
+                     int32_t * status) {
+    std::lock_guard<std::mutex> lock(server->mutex);
+
+    *done = false;
+
+    auto it = server->requests.find(request_id);
+    if (it == server->requests.end()) {
+        *done = true;
+        return 0;
+    }
+
+    auto * req = it->second.get();
+
+    size_t n = std::min(req->output.size(), (size_t) length);
+
+    // never split a UTF-8 sequence between two reads
+    while (n > 0 && n < req->output.size() && (req->output[n] & 0xC0) == 0x80) {
+        n--;
+    }
+
+    std::copy(req->output.begin(), req->output.begin() + n, buf);
+    req->output.erase(0, n);
+
+    if (req->done && req->output.empty()) {
+        *done   = true;
+        *status = req->status;
+
+        server->requests.erase(it);
+    }
+
+    return (int32_t) n;
+}
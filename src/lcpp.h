@@ -0,0 +1,417 @@
+#ifndef LCPP_H
+#define LCPP_H
+
+#include "llama.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef LCPP_SHARED
+#    if defined(_WIN32) && !defined(__MINGW32__)
+#        ifdef LCPP_BUILD
+#            define LCPP_API __declspec(dllexport)
+#        else
+#            define LCPP_API __declspec(dllimport)
+#        endif
+#    else
+#        define LCPP_API __attribute__ ((visibility ("default")))
+#    endif
+#else
+#    define LCPP_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    //
+    // Native helpers used by the Dart bindings to keep hot loops out of FFI
+    // and to share state between isolates
+    //
+
+    enum lcpp_status {
+        LCPP_STATUS_OK                 =  0,
+        LCPP_STATUS_CONTEXT_FULL       =  1, // generation stopped because the context is full
+        LCPP_STATUS_DECODE_FAILED      = -1,
+        LCPP_STATUS_DETOKENIZE_FAILED  = -2,
+        LCPP_STATUS_FILE_FAILED        = -3,
+        LCPP_STATUS_SESSION_MISMATCH   = -4, // the session belongs to another model or does not fit in the context
+        LCPP_STATUS_NO_EMBEDDINGS      = -5, // the context does not output pooled embeddings
+    };
+
+    // Called with a chunk of complete UTF-8 text (not null-terminated)
+    // Return false to stop the generation
+    typedef bool (*lcpp_text_callback)(const char * text, int32_t length, void * user_data);
+
+    // Called after each prompt chunk is decoded with the number of prompt tokens decoded so far,
+    // the prompt size and the time spent on the prompt
+    // Return false to stop the generation
+    typedef bool (*lcpp_prefill_callback)(int32_t n_decoded, int32_t n_total, double t_ms, void * user_data);
+
+    // Called for every generated token with its log-probability under the model's distribution, before
+    // sampling, and the n_top most likely tokens at its position with theirs, most likely first
+    typedef void (*lcpp_probs_callback)(
+            llama_token   token,
+                  float   logprob,
+      const llama_token * top_tokens,
+            const float * top_logprobs,
+                int32_t   n_top,
+                   void * user_data);
+
+    // Called by the producer of a stream when it has written new data, at most once until the
+    // reader has peeked at the stream again
+    typedef void (*lcpp_stream_callback)(void * user_data);
+
+    struct lcpp_stream;
+
+    // Draft model context or n-gram index used for speculative decoding
+    struct lcpp_draft;
+
+    struct lcpp_draft_stats {
+        int32_t n_steps;    // target decodes that verified a draft
+        int32_t n_drafted;  // draft tokens proposed
+        int32_t n_accepted; // draft tokens the target agreed with
+    };
+
+    // Time lcpp_generate spends outside llama_decode and the sampler, which llama_perf_context and
+    // llama_perf_sampler already measure
+    struct lcpp_generate_timings {
+        int32_t n_tokens;        // tokens sampled and detokenized
+        int32_t n_emits;         // chunks of text handed over
+        double  t_detokenize_ms; // in llama_token_to_piece
+        double  t_emit_ms;       // in text_callback or writing to the stream
+        double  t_prefill_ms;    // decoding the prompt
+        double  t_decode_ms;     // decoding after the prompt, drafting and draft verification included
+    };
+
+    struct lcpp_generate_params {
+        lcpp_text_callback text_callback;
+        void *             text_callback_user_data;
+
+        lcpp_prefill_callback prefill_callback;
+        void *                prefill_callback_user_data;
+
+        // optional, n_probs is how many of the most likely tokens are reported with each generated token
+        lcpp_probs_callback probs_callback;
+        void *              probs_callback_user_data;
+        int32_t             n_probs; // default: 0
+
+        // optional mirror of the tokens held in the KV cache for sequence 0, with room for n_ctx tokens
+        // every token decoded by lcpp_generate is appended to it and n_history is updated to match
+        llama_token * history;
+        int32_t     * n_history;
+
+        // context shifting, when the next batch would not fit the oldest half of the tokens after the first
+        // n_keep (e.g. the system prompt) is discarded and the rest is shifted back in place.
+        // Requires a model whose KV cache can shift, -1 stops with LCPP_STATUS_CONTEXT_FULL instead
+        int32_t n_keep; // default: -1
+
+        // generated text is buffered and handed to text_callback once n_flush_tokens tokens have been
+        // generated or t_flush_ms milliseconds have passed since the last flush, whichever comes first
+        // (0 disables either condition). Incomplete UTF-8 sequences are always held back
+        int32_t n_flush_tokens; // default: 1, flush after every token
+        double  t_flush_ms;     // default: 0
+
+        // optional flag checked after every token, the generation stops once it is set
+        // as the text callback no longer runs for every token
+        const bool * abort;
+
+        // optional stream that receives the text and the generated token ids instead of text_callback,
+        // the generation waits for the reader when the stream is full until abort is set
+        struct lcpp_stream * stream;
+
+        // optional draft model, every step decodes the sampled token together with the tokens the draft
+        // model predicts after it and keeps those the target samples too. Requires history
+        struct lcpp_draft * draft;
+
+        // optional timings, added to while generating
+        struct lcpp_generate_timings * timings;
+    };
+
+    struct lcpp_model_registry_stats {
+        int32_t  n_models; // models currently resident
+        int32_t  n_refs;   // references held on resident models
+        int32_t  n_loads;  // acquisitions that had to load the model from disk
+        int32_t  n_hits;   // acquisitions served by an already resident model
+        uint64_t n_bytes;  // size of the resident models' weights
+        double   t_load_ms;
+    };
+
+    // Shape of a model as described by its GGUF metadata
+    struct lcpp_model_info {
+        int32_t  n_layer;
+        int32_t  n_embd;
+        int32_t  n_ff;          // largest feed forward length of any layer
+        int32_t  n_head;
+        int32_t  n_head_kv;     // largest KV head count of any layer
+        int32_t  n_embd_head_k;
+        int32_t  n_embd_head_v;
+        int32_t  n_ctx_train;
+        int32_t  n_vocab;
+        uint64_t n_bytes;       // size of all tensors, across every file of a split model
+    };
+
+    // Called from the server thread when a request has new text to read or has finished
+    typedef void (*lcpp_server_callback)(int32_t request_id, void * user_data);
+
+    struct lcpp_server;
+
+    LCPP_API struct lcpp_generate_params lcpp_generate_default_params(void);
+
+    //
+    // Model registry
+    //
+
+    // Returns a model shared by every caller that asked for the same path with the same
+    // use_mmap, use_mlock and vocab_only settings, loading it on first use.
+    // Backends are loaded once per process before the first model is loaded, from the directory
+    // holding this library and otherwise from the executable's. When several CPU backend variants
+    // are available the one best suited to the host is picked.
+    // Returns NULL on failure
+    LCPP_API struct llama_model * lcpp_model_acquire(const char * path_model, struct llama_model_params params);
+
+    // Drops a reference returned by lcpp_model_acquire, the model is freed with its last reference
+    LCPP_API void lcpp_model_release(struct llama_model * model);
+
+    LCPP_API struct lcpp_model_registry_stats lcpp_model_registry_get_stats(void);
+
+    // Whether lcpp_model_acquire would return an already loaded model for these arguments
+    LCPP_API bool lcpp_model_is_loaded(const char * path_model, struct llama_model_params params);
+
+    // Returns a LoRA adapter of model shared by every caller that asked for the same path, loading it
+    // on first use. Adapters still loaded when their model is freed are freed with it.
+    // Returns NULL on failure
+    LCPP_API struct llama_adapter_lora * lcpp_adapter_acquire(struct llama_model * model, const char * path_lora);
+
+    // Drops a reference returned by lcpp_adapter_acquire, the adapter is freed with its last reference.
+    // Contexts it is set on must have been freed or have removed it
+    LCPP_API void lcpp_adapter_release(struct llama_adapter_lora * adapter);
+
+    // Writes a line for every backend device, with the features the loaded CPU backend variant was
+    // built for, and returns the length of the whole text (truncated to fit length)
+    LCPP_API int32_t lcpp_backend_info(char * buf, int32_t length);
+
+    // Reads the metadata of a GGUF model without loading its weights, for planning memory before a load
+    LCPP_API enum lcpp_status lcpp_model_read_info(const char * path_model, struct lcpp_model_info * info);
+
+    //
+    // Prefetch
+    //
+
+    struct lcpp_prefetch;
+
+    // Starts reading the model's files, every file of a split model, through the page cache on a
+    // background thread, so that an mmapped model does not stall its first decodes on page faults.
+    // Meant to run alongside and after a load with use_mmap
+    LCPP_API struct lcpp_prefetch * lcpp_prefetch_start(const char * path_model);
+
+    // Fraction of the bytes prefetched so far, 1 once done or stopped
+    LCPP_API float lcpp_prefetch_progress(const struct lcpp_prefetch * prefetch);
+
+    // Stops the prefetch if it is still running
+    LCPP_API void lcpp_prefetch_free(struct lcpp_prefetch * prefetch);
+
+    //
+    // Threadpools
+    //
+
+    // Applies a NUMA strategy once per process, before the first model is loaded
+    LCPP_API void lcpp_numa_init(enum ggml_numa_strategy numa);
+
+    // Returns a threadpool shared by every caller that asked for matching params (see ggml_threadpool_params_match),
+    // creating it on first use with the loaded CPU backend. Returns NULL on failure
+    LCPP_API struct ggml_threadpool * lcpp_threadpool_acquire(const struct ggml_threadpool_params * params);
+
+    // Drops a reference returned by lcpp_threadpool_acquire, the pool is freed with its last reference
+    LCPP_API void lcpp_threadpool_release(struct ggml_threadpool * threadpool);
+
+    // Attaches the pools to ctx, threadpool for single token decodes and threadpool_batch for prompts.
+    // Decodes of contexts sharing a pool are serialized instead of oversubscribing its cores
+    LCPP_API void lcpp_threadpool_attach(
+            struct llama_context * ctx,
+         struct ggml_threadpool * threadpool,
+         struct ggml_threadpool * threadpool_batch);
+
+    // Must be called before ctx is freed if it was attached
+    LCPP_API void lcpp_threadpool_detach(struct llama_context * ctx);
+
+    //
+    // Grammars
+    //
+
+    // Returns a grammar sampler cloned from a cache of parsed grammars, so a grammar sent again is not reparsed.
+    // With json_schema, grammar is a JSON schema converted to GBNF and root is ignored.
+    // Returns NULL if the grammar or schema is invalid, with the reason written to error (truncated to fit
+    // n_error, error may be NULL). llama.cpp reports where a grammar fails to parse through its log callback
+    LCPP_API struct llama_sampler * lcpp_grammar_init(
+        const struct llama_vocab * vocab,
+                      const char * grammar,
+                      const char * root,
+                              bool json_schema,
+                            char * error,
+                           int32_t n_error);
+
+    //
+    // Generation
+    //
+
+    // Decode the prompt tokens in chunks of n_batch, then sample, decode and detokenize until an end of
+    // generation token, a full context or a callback returning false.
+    // Text is passed to the callback in chunks that never split a multi-byte UTF-8 sequence, and are
+    // batched according to n_flush_tokens and t_flush_ms.
+    LCPP_API enum lcpp_status lcpp_generate(
+            struct llama_context * ctx,
+            struct llama_sampler * sampler,
+               const llama_token * tokens,
+                         int32_t   n_tokens,
+     struct lcpp_generate_params   params);
+
+    //
+    // Embeddings
+    //
+
+    // Computes the pooled embedding of n_inputs tokenized inputs stored back to back in tokens, input i
+    // being n_tokens[i] long, and writes them as rows of n_embd floats to out, normalized when normalize is set.
+    // As many inputs as fit in n_ubatch tokens and n_seq_max sequences are decoded together, each in its own
+    // sequence. The context must have embeddings enabled and a pooling type other than none, and the KV cache
+    // is cleared. An input longer than n_ubatch fails with LCPP_STATUS_CONTEXT_FULL
+    LCPP_API enum lcpp_status lcpp_embed(
+            struct llama_context * ctx,
+               const llama_token * tokens,
+                   const int32_t * n_tokens,
+                         int32_t   n_inputs,
+                            bool   normalize,
+                           float * out);
+
+    //
+    // Scoring
+    //
+
+    // Appends tokens (at least one) to sequence 0 and computes the log-probability of every token of
+    // n_candidates continuations of it. Candidate i has n_candidate_tokens[i] tokens, all candidates are
+    // concatenated in candidates and logprobs receives one value per candidate token in the same layout.
+    // The candidates are evaluated in packed batches, each in a copy of the prompt's sequence when the
+    // context has more than one, and removed afterwards. The prompt stays in the KV cache and history
+    LCPP_API enum lcpp_status lcpp_score(
+            struct llama_context * ctx,
+               const llama_token * tokens,
+                         int32_t   n_tokens,
+               const llama_token * candidates,
+                   const int32_t * n_candidate_tokens,
+                         int32_t   n_candidates,
+                           float * logprobs,
+     struct lcpp_generate_params   params);
+
+    //
+    // Speculative decoding
+    //
+
+    // Whether the draft model tokenizes text exactly like the target model
+    LCPP_API bool lcpp_vocab_compatible(const struct llama_model * model_tgt, const struct llama_model * model_dft);
+
+    // Drafts up to n_draft tokens per step with ctx, stopping early when the most likely token is less
+    // probable than p_min. ctx must be a context of a model compatible with the target and is not freed
+    LCPP_API struct lcpp_draft * lcpp_draft_init(struct llama_context * ctx, int32_t n_draft, float p_min);
+
+    // Drafts up to n_draft tokens per step by prompt lookup: the longest n-gram of n_min to n_max tokens
+    // ending the history is looked up in the history, and the tokens that followed its last occurrence
+    // are proposed. Nothing is drafted without a match, so the step decodes a single token as usual
+    LCPP_API struct lcpp_draft * lcpp_draft_init_ngram(int32_t n_draft, int32_t n_min, int32_t n_max);
+
+    LCPP_API void lcpp_draft_free(struct lcpp_draft * draft);
+
+    // Totals since the draft was created
+    LCPP_API struct lcpp_draft_stats lcpp_draft_get_stats(const struct lcpp_draft * draft);
+
+    //
+    // Sessions
+    //
+
+    // Writes sequence 0 to path: a header with a fingerprint of the model and the context sizes,
+    // the n_tokens tokens it holds and its KV cache
+    LCPP_API enum lcpp_status lcpp_session_save(
+            struct llama_context * ctx,
+                      const char * path,
+               const llama_token * tokens,
+                         int32_t   n_tokens);
+
+    // Replaces sequence 0 with a session written by lcpp_session_save, mapping the file instead of
+    // reading it where possible. The tokens are copied to tokens, which has room for n_capacity
+    LCPP_API enum lcpp_status lcpp_session_load(
+            struct llama_context * ctx,
+                      const char * path,
+                     llama_token * tokens,
+                         int32_t   n_capacity,
+                         int32_t * n_tokens);
+
+    //
+    // Streams
+    //
+
+    // A single-producer, single-consumer pair of ring buffers holding up to n_text bytes of UTF-8 text
+    // and n_tokens token ids, shared by the thread generating and the thread reading the output
+    // without copies through the Dart isolate ports. The callback must be safe to call from the producer
+    LCPP_API struct lcpp_stream * lcpp_stream_init(
+                         int32_t   n_text,
+                         int32_t   n_tokens,
+            lcpp_stream_callback   callback,
+                            void * user_data);
+
+    LCPP_API void lcpp_stream_free(struct lcpp_stream * stream);
+
+    // Points text at the oldest unread bytes and returns how many can be read contiguously.
+    // The text stays valid until it is consumed, a multi-byte sequence may span two reads
+    LCPP_API int32_t lcpp_stream_peek_text(struct lcpp_stream * stream, const char ** text);
+
+    LCPP_API void lcpp_stream_consume_text(struct lcpp_stream * stream, int32_t n);
+
+    // Same as lcpp_stream_peek_text for the generated token ids
+    LCPP_API int32_t lcpp_stream_peek_tokens(struct lcpp_stream * stream, const llama_token ** tokens);
+
+    LCPP_API void lcpp_stream_consume_tokens(struct lcpp_stream * stream, int32_t n);
+
+    //
+    // Continuous batching server
+    //
+
+    // Serve up to llama_n_seq_max(ctx) requests at once from a background thread that owns ctx,
+    // each request gets its own sequence and a clone of the submitted sampler.
+    // Every step packs one token of each generating request and as much pending prompt as fits
+    // into a single llama_batch. Requests wait in a queue until a sequence is free. Prompts only take
+    // the KV cells generating requests leave free and wait otherwise. When the generating requests
+    // alone do not fit, or no prompt can go on, a request still decoding its prompt is evicted with
+    // LCPP_STATUS_CONTEXT_FULL before a generating one, the one holding the most cells among them.
+    LCPP_API struct lcpp_server * lcpp_server_init(
+            struct llama_context * ctx,
+            lcpp_server_callback   callback,
+                            void * user_data);
+
+    // Stops the server thread and drops every request, ctx is not freed
+    LCPP_API void lcpp_server_free(struct lcpp_server * server);
+
+    // Queues a request and returns its id, or -1 if there is nothing to decode
+    LCPP_API int32_t lcpp_server_submit(
+             struct lcpp_server * server,
+      const struct llama_sampler * sampler,
+               const llama_token * tokens,
+                         int32_t   n_tokens);
+
+    // The request finishes with whatever it has produced so far
+    LCPP_API void lcpp_server_cancel(struct lcpp_server * server, int32_t request_id);
+
+    // Copies up to length bytes of the request's unread text into buf without splitting UTF-8 sequences
+    // and returns the number of bytes copied. Once the request has finished and all its text has been
+    // read, done is set, status receives the request's lcpp_status and the request is released.
+    LCPP_API int32_t lcpp_server_read(
+             struct lcpp_server * server,
+                         int32_t   request_id,
+                            char * buf,
+                         int32_t   length,
+                            bool * done,
+                         int32_t * status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LCPP_H
@@ -0,0 +1,370 @@
+// Measures prefill and decode throughput, time to first token and memory use of a GGUF model on the CPU,
+// loading it the way the Dart bindings do: llama_model_default_params / llama_context_default_params
+// with only the swept settings overridden.
+//
+//   lcpp_bench -m model.gguf [-p 128,512] [-n 128] [-b 512] [-t 4,8] [-ctk f16,q8_0] [-ctv f16,q8_0] [-r 3] [-o json|csv]
+//
+// Every combination of the comma separated lists is run -r times and the means are printed.
+// kv_bytes is the resident memory creating the combination's context took, rss_bytes the resident memory
+// after its runs and peak_rss_bytes the peak since it started. The peak needs Linux to reset the process
+// high water mark.
+
+#include "lcpp.h"
+
+#include "ggml.h"
+#include "ggml-backend.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct bench_params {
+    std::string           model;
+    std::vector<int32_t>  n_prompt  = { 512 };
+    int32_t               n_gen     = 128;
+    std::vector<int32_t>  n_batch   = { 512 };
+    std::vector<int32_t>  n_threads = { (int32_t) std::max(1u, std::thread::hardware_concurrency() / 2) };
+    std::vector<ggml_type> type_k   = { GGML_TYPE_F16 };
+    std::vector<ggml_type> type_v   = { GGML_TYPE_F16 };
+    int32_t               n_reps    = 3;
+    bool                  use_mmap  = true;
+    bool                  csv       = false;
+};
+
+struct bench_result {
+    int32_t   n_prompt;
+    int32_t   n_gen;
+    int32_t   n_batch;
+    int32_t   n_threads;
+    ggml_type type_k;
+    ggml_type type_v;
+
+    double   prefill_tps = 0.0;
+    double   decode_tps  = 0.0;
+    double   ttft_ms     = 0.0;
+    uint64_t kv_bytes    = 0; // resident memory llama_init_from_model added
+    uint64_t rss_bytes   = 0; // resident after the runs of this combination
+    uint64_t peak_bytes  = 0; // peak resident during this combination, 0 where it cannot be reset
+};
+
+static void print_usage(const char * argv0) {
+    fprintf(stderr, "usage: %s -m model.gguf [options]\n\n", argv0);
+    fprintf(stderr, "  -p,   --n-prompt N,...     prompt lengths (default: 512)\n");
+    fprintf(stderr, "  -n,   --n-gen N            tokens generated per run (default: 128)\n");
+    fprintf(stderr, "  -b,   --batch-size N,...   n_batch and n_ubatch (default: 512)\n");
+    fprintf(stderr, "  -t,   --threads N,...      n_threads and n_threads_batch (default: half the cores)\n");
+    fprintf(stderr, "  -ctk, --cache-type-k T,... K cache types (default: f16)\n");
+    fprintf(stderr, "  -ctv, --cache-type-v T,... V cache types, quantized ones enable flash attention (default: f16)\n");
+    fprintf(stderr, "  -r,   --repetitions N      runs per combination (default: 3)\n");
+    fprintf(stderr, "  -o,   --output json|csv    output format (default: json)\n");
+    fprintf(stderr, "        --no-mmap            load the weights without mmap\n");
+}
+
+template <typename T, typename F>
+static bool parse_list(const char * arg, std::vector<T> & out, F parse) {
+    out.clear();
+
+    std::stringstream stream(arg);
+    std::string item;
+
+    while (std::getline(stream, item, ',')) {
+        T value;
+        if (!parse(item, value)) {
+            return false;
+        }
+
+        out.push_back(value);
+    }
+
+    return !out.empty();
+}
+
+static bool parse_int(const std::string & text, int32_t & value) {
+    char * end = nullptr;
+    value = (int32_t) std::strtol(text.c_str(), &end, 10);
+
+    return end != text.c_str() && *end == '\0' && value > 0;
+}
+
+static bool parse_type(const std::string & text, ggml_type & value) {
+    for (int i = 0; i < GGML_TYPE_COUNT; ++i) {
+        const char * name = ggml_type_name((ggml_type) i);
+
+        if (name != nullptr && text == name) {
+            value = (ggml_type) i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool parse_args(int argc, char ** argv, bench_params & params) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+
+        if (arg == "--no-mmap") {
+            params.use_mmap = false;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            return false;
+        }
+
+        const char * value = argv[++i];
+        bool ok = true;
+
+        if (arg == "-m" || arg == "--model") {
+            params.model = value;
+        } else if (arg == "-p" || arg == "--n-prompt") {
+            ok = parse_list(value, params.n_prompt, parse_int);
+        } else if (arg == "-n" || arg == "--n-gen") {
+            ok = parse_int(value, params.n_gen);
+        } else if (arg == "-b" || arg == "--batch-size") {
+            ok = parse_list(value, params.n_batch, parse_int);
+        } else if (arg == "-t" || arg == "--threads") {
+            ok = parse_list(value, params.n_threads, parse_int);
+        } else if (arg == "-ctk" || arg == "--cache-type-k") {
+            ok = parse_list(value, params.type_k, parse_type);
+        } else if (arg == "-ctv" || arg == "--cache-type-v") {
+            ok = parse_list(value, params.type_v, parse_type);
+        } else if (arg == "-r" || arg == "--repetitions") {
+            ok = parse_int(value, params.n_reps);
+        } else if (arg == "-o" || arg == "--output") {
+            params.csv = std::strcmp(value, "csv") == 0;
+            ok = params.csv || std::strcmp(value, "json") == 0;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "invalid argument: %s %s\n", arg.c_str(), value);
+            return false;
+        }
+    }
+
+    return !params.model.empty();
+}
+
+// Reads a field of /proc/self/status in bytes, 0 where it is not available
+static uint64_t read_status_bytes(const char * field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line)) {
+        if (line.compare(0, std::strlen(field), field) == 0) {
+            return std::strtoull(line.c_str() + std::strlen(field) + 1, nullptr, 10) * 1024;
+        }
+    }
+
+    return 0;
+}
+
+// Resets the peak resident set size of the process reported as VmHWM, Linux only
+static bool reset_peak_rss() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    clear_refs.flush();
+
+    return clear_refs.good();
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Prefills n_prompt random tokens in n_batch chunks, samples the first token and generates n_gen tokens greedily
+static bool run(llama_context * ctx, llama_sampler * sampler, bench_result & result) {
+    const llama_vocab * vocab   = llama_model_get_vocab(llama_get_model(ctx));
+    const int32_t       n_vocab = llama_vocab_n_tokens(vocab);
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<llama_token> dist(0, n_vocab - 1);
+
+    std::vector<llama_token> prompt(result.n_prompt);
+    for (auto & token : prompt) {
+        token = dist(rng);
+    }
+
+    llama_kv_cache_clear(ctx);
+    llama_sampler_reset(sampler);
+
+    const auto t_start = std::chrono::steady_clock::now();
+
+    for (int32_t i = 0; i < result.n_prompt; i += result.n_batch) {
+        const int32_t n_chunk = std::min(result.n_batch, result.n_prompt - i);
+
+        if (llama_decode(ctx, llama_batch_get_one(prompt.data() + i, n_chunk)) != 0) {
+            return false;
+        }
+    }
+
+    const double t_prefill_ms = elapsed_ms(t_start);
+
+    llama_token token = llama_sampler_sample(sampler, ctx, -1);
+
+    const double t_first_ms = elapsed_ms(t_start);
+    const auto   t_decode   = std::chrono::steady_clock::now();
+
+    // end of generation tokens are decoded like any other so every run generates n_gen tokens
+    for (int32_t i = 0; i < result.n_gen; ++i) {
+        if (llama_decode(ctx, llama_batch_get_one(&token, 1)) != 0) {
+            return false;
+        }
+
+        token = llama_sampler_sample(sampler, ctx, -1);
+    }
+
+    const double t_decode_ms = elapsed_ms(t_decode);
+
+    result.prefill_tps += result.n_prompt * 1000.0 / t_prefill_ms;
+    result.decode_tps  += result.n_gen * 1000.0 / t_decode_ms;
+    result.ttft_ms     += t_first_ms;
+
+    return true;
+}
+
+static void print_json(const std::vector<bench_result> & results, const bench_params & params) {
+    printf("[\n");
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const bench_result & r = results[i];
+
+        printf("  {\"model\": \"%s\", \"n_prompt\": %d, \"n_gen\": %d, \"n_batch\": %d, \"n_threads\": %d, \"type_k\": \"%s\", \"type_v\": \"%s\", "
+               "\"prefill_tps\": %.2f, \"decode_tps\": %.2f, \"ttft_ms\": %.2f, \"kv_bytes\": %llu, \"rss_bytes\": %llu, \"peak_rss_bytes\": %llu}%s\n",
+            params.model.c_str(), r.n_prompt, r.n_gen, r.n_batch, r.n_threads, ggml_type_name(r.type_k), ggml_type_name(r.type_v),
+            r.prefill_tps, r.decode_tps, r.ttft_ms,
+            (unsigned long long) r.kv_bytes, (unsigned long long) r.rss_bytes, (unsigned long long) r.peak_bytes,
+            i + 1 < results.size() ? "," : "");
+    }
+
+    printf("]\n");
+}
+
+static void print_csv(const std::vector<bench_result> & results, const bench_params & params) {
+    printf("model,n_prompt,n_gen,n_batch,n_threads,type_k,type_v,prefill_tps,decode_tps,ttft_ms,kv_bytes,rss_bytes,peak_rss_bytes\n");
+
+    for (const bench_result & r : results) {
+        printf("\"%s\",%d,%d,%d,%d,%s,%s,%.2f,%.2f,%.2f,%llu,%llu,%llu\n",
+            params.model.c_str(), r.n_prompt, r.n_gen, r.n_batch, r.n_threads, ggml_type_name(r.type_k), ggml_type_name(r.type_v),
+            r.prefill_tps, r.decode_tps, r.ttft_ms,
+            (unsigned long long) r.kv_bytes, (unsigned long long) r.rss_bytes, (unsigned long long) r.peak_bytes);
+    }
+}
+
+int main(int argc, char ** argv) {
+    bench_params params;
+
+    if (!parse_args(argc, argv, params)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // the model registry loads the backends, an empty device list keeps everything on the CPU
+    // so that results are comparable between hosts
+    ggml_backend_dev_t devices[] = { nullptr };
+
+    llama_model_params model_params = llama_model_default_params();
+    model_params.devices      = devices;
+    model_params.use_mmap     = params.use_mmap;
+    model_params.n_gpu_layers = 0;
+
+    llama_model * model = lcpp_model_acquire(params.model.c_str(), model_params);
+    if (model == nullptr) {
+        fprintf(stderr, "failed to load model: %s\n", params.model.c_str());
+        return 1;
+    }
+
+    llama_sampler * sampler = llama_sampler_init_greedy();
+
+    std::vector<bench_result> results;
+
+    for (const int32_t n_prompt : params.n_prompt) {
+    for (const int32_t n_batch : params.n_batch) {
+    for (const int32_t n_threads : params.n_threads) {
+    for (const ggml_type type_k : params.type_k) {
+    for (const ggml_type type_v : params.type_v) {
+        // the peak is kept per combination, the model's pages stay resident from earlier ones
+        const bool peak_reset = reset_peak_rss();
+
+        llama_context_params ctx_params = llama_context_default_params();
+        ctx_params.n_ctx           = n_prompt + params.n_gen + 1;
+        ctx_params.n_batch         = n_batch;
+        ctx_params.n_ubatch        = n_batch;
+        ctx_params.n_threads       = n_threads;
+        ctx_params.n_threads_batch = n_threads;
+        ctx_params.type_k          = type_k;
+        ctx_params.type_v          = type_v;
+        ctx_params.flash_attn      = type_v != GGML_TYPE_F16;
+        ctx_params.offload_kqv     = false;
+
+        // the KV cache is cleared when the context is created, so its pages are resident right away while
+        // the compute buffers are only touched by the first decode
+        const uint64_t rss_before = read_status_bytes("VmRSS:");
+
+        llama_context * ctx = llama_init_from_model(model, ctx_params);
+        if (ctx == nullptr) {
+            fprintf(stderr, "failed to create context: n_prompt %d n_batch %d type_k %s type_v %s\n", n_prompt, n_batch, ggml_type_name(type_k), ggml_type_name(type_v));
+            continue;
+        }
+
+        bench_result result = {};
+        result.n_prompt  = n_prompt;
+        result.n_gen     = params.n_gen;
+        result.n_batch   = n_batch;
+        result.n_threads = n_threads;
+        result.type_k    = type_k;
+        result.type_v    = type_v;
+        result.kv_bytes  = std::max(read_status_bytes("VmRSS:"), rss_before) - rss_before;
+
+        // warmup, results of the first run are discarded
+        bench_result warmup = result;
+        warmup.n_prompt = std::min(n_prompt, n_batch);
+        warmup.n_gen    = 1;
+
+        bool ok = run(ctx, sampler, warmup);
+
+        for (int32_t rep = 0; ok && rep < params.n_reps; ++rep) {
+            ok = run(ctx, sampler, result);
+        }
+
+        if (ok) {
+            result.prefill_tps /= params.n_reps;
+            result.decode_tps  /= params.n_reps;
+            result.ttft_ms     /= params.n_reps;
+            result.rss_bytes    = read_status_bytes("VmRSS:");
+            result.peak_bytes   = peak_reset ? read_status_bytes("VmHWM:") : 0;
+
+            results.push_back(result);
+        } else {
+            fprintf(stderr, "decode failed: n_prompt %d n_batch %d type_k %s type_v %s\n", n_prompt, n_batch, ggml_type_name(type_k), ggml_type_name(type_v));
+        }
+
+        llama_free(ctx);
+    }
+    }
+    }
+    }
+    }
+
+    llama_sampler_free(sampler);
+    lcpp_model_release(model);
+
+    if (params.csv) {
+        print_csv(results, params);
+    } else {
+        print_json(results, params);
+    }
+
+    return results.empty() ? 1 : 0;
+}
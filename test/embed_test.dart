@@ -0,0 +1,33 @@
+import 'dart:io';
+import 'dart:math';
+
+import 'package:flutter_test/flutter_test.dart';
+import 'package:lcpp/lcpp.dart';
+
+void main() {
+  // An embedding model in GGUF format, e.g. nomic-embed-text or bge, with the native libraries built
+  final modelPath = Platform.environment['LCPP_EMBED_MODEL'];
+
+  test('an input longer than the default ubatch is embedded whole', () async {
+    final llama = LlamaCPP(
+      modelPath!,
+      ModelParams(),
+      ContextParams(nCtx: 2048, nBatch: 2048, poolingType: PoolingType.mean),
+      SamplingParams(),
+    );
+
+    try {
+      // Well over the 512 tokens llama.cpp decodes in one ubatch by default
+      final input = List.generate(800, (i) => 'word$i').join(' ');
+      final vector = await llama.embed(input);
+
+      final norm = sqrt(vector.fold<double>(0, (sum, value) => sum + value * value));
+
+      expect(vector, isNotEmpty);
+      expect(vector.every((value) => value.isFinite), isTrue);
+      expect(norm, closeTo(1.0, 1e-3));
+    } finally {
+      await llama.dispose();
+    }
+  }, skip: modelPath == null ? 'LCPP_EMBED_MODEL is not set' : false);
+}
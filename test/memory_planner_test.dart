@@ -0,0 +1,66 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:lcpp/lcpp.dart';
+
+void main() {
+  // Shaped like a 7B Llama with 4 GB of weights
+  ModelInfo model({int trainContextLength = 4096}) => ModelInfo(
+    layers: 32,
+    embeddingLength: 4096,
+    feedForwardLength: 11008,
+    heads: 32,
+    headsKv: 32,
+    keyLength: 128,
+    valueLength: 128,
+    trainContextLength: trainContextLength,
+    vocabSize: 32000,
+    weightBytes: 4000000000,
+  );
+
+  const gb = 1000000000;
+
+  test('a large budget gets the whole training context at full precision', () {
+    final plan = MemoryPlanner(model()).plan(16 * gb)!;
+
+    expect(plan.nCtx, 4096);
+    expect(plan.typeK, GgmlType.f16);
+    expect(plan.typeV, GgmlType.f16);
+    expect(plan.estimate.totalBytes, lessThanOrEqualTo(16 * gb));
+  });
+
+  test('a tight budget gets the largest context that fits', () {
+    final planner = MemoryPlanner(model());
+    final plan = planner.plan(5 * gb)!;
+
+    expect(plan.nCtx % 256, 0);
+    expect(plan.nCtx, lessThan(4096));
+    expect(plan.estimate.totalBytes, lessThanOrEqualTo(5 * gb));
+
+    final larger = planner.estimate(nCtx: plan.nCtx + 256, typeK: plan.typeK, typeV: plan.typeV, nBatch: plan.nBatch);
+    expect(larger.totalBytes, greaterThan(5 * gb));
+  });
+
+  test('quantized V caches need flash attention', () {
+    final plan = MemoryPlanner(model()).plan(5 * gb)!;
+    expect(plan.typeV, GgmlType.f16);
+
+    final flash = MemoryPlanner(model()).plan(5 * gb, ContextParams(flashAttention: true))!;
+    expect(flash.nCtx, greaterThanOrEqualTo(plan.nCtx));
+  });
+
+  test('nothing fits below the weights', () {
+    expect(MemoryPlanner(model()).plan(3 * gb), isNull);
+  });
+
+  test('weights already loaded are left out', () {
+    final plan = MemoryPlanner(model()).plan(3 * gb, null, true)!;
+
+    expect(plan.estimate.weightBytes, 0);
+    expect(plan.estimate.totalBytes, lessThanOrEqualTo(3 * gb));
+  });
+
+  test('a training context shorter than 256 tokens is taken whole', () {
+    final plan = MemoryPlanner(model(trainContextLength: 128)).plan(16 * gb)!;
+
+    expect(plan.nCtx, 128);
+  });
+}
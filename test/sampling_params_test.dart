@@ -0,0 +1,44 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:lcpp/lcpp.dart';
+
+void main() {
+  SamplingParams params({double temperature = 0.8, List<String>? breakers}) => SamplingParams(
+    seed: 42,
+    topK: 40,
+    topP: (p: 0.95, minKeep: 1),
+    temperature: (temperature: temperature, delta: null, exponent: null),
+    grammar: (str: 'root ::= "yes" | "no"', root: 'root'),
+    drySampler: (
+      nCtxTrain: 4096,
+      multiplier: 0.8,
+      dryBase: 1.75,
+      allowedLength: 2,
+      penaltyLastN: -1,
+      sequenceBreakers: breakers ?? ['\n', ':']
+    ),
+  );
+
+  test('equal values are equal params', () {
+    expect(params(), params());
+    expect(params().hashCode, params().hashCode);
+  });
+
+  test('sequence breakers compare by value', () {
+    expect(params(breakers: ['\n', ':']), params());
+    expect(params(breakers: [':', '\n']), isNot(params()));
+  });
+
+  test('different values are different params', () {
+    expect(params(temperature: 0.2), isNot(params()));
+    expect(SamplingParams(greedy: true), isNot(SamplingParams()));
+    expect(SamplingParams(jsonSchema: (schema: '{}')), isNot(SamplingParams()));
+  });
+
+  test('equal params share a map entry', () {
+    final pool = {params(): 1};
+    pool[params()] = 2;
+
+    expect(pool.length, 1);
+    expect(pool[params()], 2);
+  });
+}
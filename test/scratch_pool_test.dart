@@ -0,0 +1,108 @@
+import 'dart:ffi' as ffi;
+import 'dart:io';
+
+import 'package:ffi/ffi.dart';
+import 'package:flutter_test/flutter_test.dart';
+import 'package:lcpp/lcpp.dart';
+
+void main() {
+  final messages = [
+    ChatMessage(role: 'system', content: 'You are a helpful assistant.'),
+    ChatMessage(role: 'user', content: 'What is the capital of France?'),
+    ChatMessage(role: 'assistant', content: 'Paris.'),
+    ChatMessage(role: 'user', content: 'And of Italy?'),
+  ];
+
+  // The buffers a prompt goes through: messages and rendered text for the template, then tokens
+  void prompt(ScratchPool pool, List<ChatMessage> messages, int nCtx) {
+    pool.messages(messages);
+    pool.text(nCtx);
+
+    final input = pool.string(messages.last.content);
+    pool.tokens(input.length + 16);
+  }
+
+  test('allocations stay flat over repeated prompts', () {
+    final pool = ScratchPool();
+
+    prompt(pool, messages, 4096);
+    final allocations = pool.allocations;
+    final bytes = pool.bytes;
+
+    for (var i = 0; i < 1000; i++) {
+      prompt(pool, messages, 4096);
+    }
+
+    expect(pool.allocations, allocations);
+    expect(pool.bytes, bytes);
+
+    pool.dispose();
+  });
+
+  test('buffers only grow for larger prompts', () {
+    final pool = ScratchPool();
+
+    prompt(pool, messages, 4096);
+    final allocations = pool.allocations;
+
+    prompt(pool, messages.sublist(0, 2), 1024);
+    expect(pool.allocations, allocations);
+
+    final longer = [...messages, ChatMessage(role: 'assistant', content: 'Rome. ' * 200)];
+    prompt(pool, longer, 8192);
+    expect(pool.allocations, greaterThan(allocations));
+
+    final grown = pool.allocations;
+
+    for (var i = 0; i < 100; i++) {
+      prompt(pool, i.isEven ? longer : messages, 8192);
+    }
+
+    expect(pool.allocations, grown);
+
+    pool.dispose();
+    expect(pool.bytes, 0);
+  });
+
+  // A chat model in GGUF format, only its vocab and template are loaded
+  final modelPath = Platform.environment['LCPP_TEST_MODEL'];
+
+  test('native memory stays flat over repeated chat tokenize and format cycles', () {
+    final params = LlamaCPP.lib.llama_model_default_params()..vocab_only = true;
+    final path = modelPath!.toNativeUtf8();
+    final model = LlamaCPP.lib.llama_model_load_from_file(path.cast<ffi.Char>(), params);
+    malloc.free(path);
+
+    expect(model, isNot(ffi.nullptr));
+
+    final pool = ScratchPool();
+    final chat = ChatCache(pool);
+    final template = LlamaCPP.lib.llama_model_chat_template(model, ffi.nullptr);
+
+    // What the inference isolate does for every prompt: the cached tokens of the conversation, and
+    // the rendered text of the whole conversation for sessions
+    void cycle() {
+      chat.tokenize(model, messages);
+
+      final length = LlamaCPP.lib.llama_chat_apply_template(template, pool.messages(messages), messages.length, true, pool.text(4096), 4096);
+      expect(length, inInclusiveRange(1, 4096));
+    }
+
+    cycle();
+    final allocations = pool.allocations;
+    final bytes = pool.bytes;
+
+    for (var i = 0; i < 1000; i++) {
+      cycle();
+    }
+
+    expect(pool.allocations, allocations);
+    expect(pool.bytes, bytes);
+
+    chat.dispose();
+    pool.dispose();
+    expect(pool.bytes, 0);
+
+    LlamaCPP.lib.llama_model_free(model);
+  }, skip: modelPath == null ? 'LCPP_TEST_MODEL is not set' : false);
+}